@@ -0,0 +1,79 @@
+/*
+ * Wrappers for the Linux interfaces that C libraries only declare as GNU
+ * extensions.  This is the only place that enables them; see linux.h.
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "linux.h"
+
+long linux_syscall(long nr, long arg1, long arg2, long arg3)
+{
+	return syscall(nr, arg1, arg2, arg3);
+}
+
+int linux_open_flag(const char *name, size_t len)
+{
+#define IS(flag) (len == sizeof(flag) - 1 && strncmp(name, flag, len) == 0)
+#ifdef O_DIRECT
+	if (IS("direct"))
+		return O_DIRECT;
+#endif
+#ifdef O_NOATIME
+	if (IS("noatime"))
+		return O_NOATIME;
+#endif
+#undef IS
+	return 0;
+}
+
+int linux_set_pipe_size(int fd, int size)
+{
+#ifdef F_SETPIPE_SZ
+	return fcntl(fd, F_SETPIPE_SZ, size);
+#else
+	(void)fd;
+	(void)size;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int linux_memfd(const char *name)
+{
+#ifdef MFD_CLOEXEC
+	return memfd_create(name, MFD_CLOEXEC);
+#else
+	(void)name;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+ssize_t linux_splice(int rfd, int wfd, off_t *off, size_t len)
+{
+	loff_t loff = off ? *off : 0;
+	ssize_t ret = splice(rfd, NULL, wfd, off ? &loff : NULL, len,
+	                     SPLICE_F_MOVE|SPLICE_F_MORE);
+	if (ret >= 0 && off)
+		*off = loff;
+	return ret;
+}
+
+ssize_t linux_tee(int rfd, int wfd, size_t len)
+{
+	return tee(rfd, wfd, len, 0);
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Wrappers for the Linux interfaces that C libraries only declare as GNU
+ * extensions.  Keeping them out of nosig.c lets it stick to C11 & POSIX so
+ * the builds catch any other non-portable calls.
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+#ifndef NOSIG_LINUX_H
+#define NOSIG_LINUX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Call syscall |nr| with (up to) three arguments. */
+long linux_syscall(long nr, long arg1, long arg2, long arg3);
+
+/* The open(2) flag for |name| (of |len| bytes), or 0 if it's unknown. */
+int linux_open_flag(const char *name, size_t len);
+
+/* Set the size of the pipe |fd| via F_SETPIPE_SZ. */
+int linux_set_pipe_size(int fd, int size);
+
+/* Create a close-on-exec memfd.  Returns -1 if the kernel or C library can't. */
+int linux_memfd(const char *name);
+
+/*
+ * Like splice(2) from the pipe |rfd| to |wfd| at |off| (if not NULL).
+ * Fails with EINVAL when the output doesn't support it.
+ */
+ssize_t linux_splice(int rfd, int wfd, off_t *off, size_t len);
+
+/* Like tee(2) between the pipes |rfd| & |wfd|. */
+ssize_t linux_tee(int rfd, int wfd, size_t len);
+
+#endif
@@ -0,0 +1,603 @@
+/*
+ * A minimal freestanding build of nosig for the hot path: set up the signal
+ * state & exec the program.  It doesn't use the C library at all (no stdio,
+ * no heap, no dynamic linking), just raw syscalls, so it starts about as fast
+ * as a program can.  Only the signal options are supported; everything else
+ * (e.g. --help & --list) needs the full nosig.
+ *
+ * Only Linux on x86_64 & aarch64 is supported.  They share the generic signal
+ * numbers.  We can't know which C library the program uses, so we always use
+ * glibc's numbering where the first two realtime signals are reserved (so
+ * SIGRTMIN is 34).  Others may differ (e.g. musl reserves three, so its
+ * SIGRTMIN is 35).
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(__linux__) || !(defined(__x86_64__) || defined(__aarch64__))
+# error "nosig-tiny only supports Linux on x86_64 & aarch64"
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#define ATTR_NORETURN __attribute__((__noreturn__))
+
+/* Same exit codes as nosig. */
+#define EXIT_OK 0
+#define EXIT_ERR 125
+#define EXIT_PROG_NOT_EXEC 126
+#define EXIT_PROG_NOT_FOUND 127
+
+#define SIGKILL 9
+#define SIGSTOP 19
+/* glibc's SIGRTMIN (see the top). */
+#define SIGRTMIN 34
+#define SIGRTMAX 64
+#define SIG_BLOCK 0
+#define SIG_UNBLOCK 1
+#define SIG_SETMASK 2
+
+#define ENOENT 2
+#define ENOEXEC 8
+#define EACCES 13
+#define ENOTDIR 20
+#define EINVAL 22
+
+/*
+ * Raw syscall support.
+ */
+#ifdef __x86_64__
+# define SYS_write 1
+# define SYS_rt_sigaction 13
+# define SYS_rt_sigprocmask 14
+# define SYS_execve 59
+# define SYS_exit_group 231
+
+__asm__(
+	".text\n"
+	".global _start\n"
+	"_start:\n"
+	"	xor %rbp, %rbp\n"
+	"	mov %rsp, %rdi\n"
+	"	and $-16, %rsp\n"
+	"	call tiny_main\n"
+	"	hlt\n"
+);
+
+static long syscall4(long nr, long a, long b, long c, long d)
+{
+	long ret;
+	register long r10 __asm__("r10") = d;
+	__asm__ volatile("syscall"
+	                 : "=a"(ret)
+	                 : "a"(nr), "D"(a), "S"(b), "d"(c), "r"(r10)
+	                 : "rcx", "r11", "memory");
+	return ret;
+}
+#else
+# define SYS_write 64
+# define SYS_exit_group 94
+# define SYS_rt_sigaction 134
+# define SYS_rt_sigprocmask 135
+# define SYS_execve 221
+
+__asm__(
+	".text\n"
+	".global _start\n"
+	"_start:\n"
+	"	mov x29, #0\n"
+	"	mov x30, #0\n"
+	"	mov x0, sp\n"
+	"	and sp, x0, #-16\n"
+	"	bl tiny_main\n"
+	"	b .\n"
+);
+
+static long syscall4(long nr, long a, long b, long c, long d)
+{
+	register long x8 __asm__("x8") = nr;
+	register long x0 __asm__("x0") = a;
+	register long x1 __asm__("x1") = b;
+	register long x2 __asm__("x2") = c;
+	register long x3 __asm__("x3") = d;
+	__asm__ volatile("svc 0"
+	                 : "+r"(x0)
+	                 : "r"(x8), "r"(x1), "r"(x2), "r"(x3)
+	                 : "memory", "cc");
+	return x0;
+}
+#endif
+
+#define syscall3(nr, a, b, c) syscall4(nr, a, b, c, 0)
+
+ATTR_NORETURN
+static void sys_exit(int status)
+{
+	for (;;)
+		syscall3(SYS_exit_group, status, 0, 0);
+}
+
+/* The kernel's view of sigaction (not the C library's). */
+struct ksigaction {
+	unsigned long handler;
+	unsigned long flags;
+	unsigned long restorer;
+	uint64_t mask;
+};
+#define KSIG_DFL 0
+#define KSIG_IGN 1
+
+/*
+ * Minimal string & output helpers.
+ */
+static size_t tiny_strlen(const char *s)
+{
+	size_t len = 0;
+	while (s[len])
+		++len;
+	return len;
+}
+
+static bool tiny_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2)
+		++s1, ++s2;
+	return *s1 == *s2;
+}
+
+static bool tiny_startswith(const char *s, const char *prefix)
+{
+	while (*prefix)
+		if (*s++ != *prefix++)
+			return false;
+	return true;
+}
+
+static void write_str(const char *s)
+{
+	syscall3(SYS_write, 2, (long)s, tiny_strlen(s));
+}
+
+/* Like warnx/errx: "nosig-tiny: |msg|[: |arg|]". */
+static void warn_msg(const char *msg, const char *arg)
+{
+	write_str("nosig-tiny: ");
+	write_str(msg);
+	if (arg) {
+		write_str(": ");
+		write_str(arg);
+	}
+	write_str("\n");
+}
+
+ATTR_NORETURN
+static void die(int status, const char *msg, const char *arg)
+{
+	warn_msg(msg, arg);
+	sys_exit(status);
+}
+
+/* Convert a (non-negative) decimal number with error checking. */
+static long tiny_atoi(const char *s)
+{
+	long ret = 0;
+	if (*s == '\0')
+		die(EXIT_ERR, "error: could not decode", s);
+	for (; *s; ++s) {
+		if (*s < '0' || *s > '9' || ret > SIGRTMAX)
+			die(EXIT_ERR, "error: could not decode", s);
+		ret = ret * 10 + (*s - '0');
+	}
+	return ret;
+}
+
+/*
+ * Signal handling.
+ */
+static const struct {
+	const char *name;
+	int value;
+} signals[] = {
+	{ "HUP", 1 }, { "INT", 2 }, { "QUIT", 3 }, { "ILL", 4 }, { "TRAP", 5 },
+	{ "ABRT", 6 }, { "IOT", 6 }, { "BUS", 7 }, { "FPE", 8 }, { "KILL", 9 },
+	{ "USR1", 10 }, { "SEGV", 11 }, { "USR2", 12 }, { "PIPE", 13 },
+	{ "ALRM", 14 }, { "TERM", 15 }, { "STKFLT", 16 }, { "CHLD", 17 },
+	{ "CLD", 17 }, { "CONT", 18 }, { "STOP", 19 }, { "TSTP", 20 },
+	{ "TTIN", 21 }, { "TTOU", 22 }, { "URG", 23 }, { "XCPU", 24 },
+	{ "XFSZ", 25 }, { "VTALRM", 26 }, { "PROF", 27 }, { "WINCH", 28 },
+	{ "IO", 29 }, { "POLL", 29 }, { "PWR", 30 }, { "SYS", 31 },
+};
+
+/* Whether |sig| is reserved by the C library (and thus skipped). */
+static bool sig_reserved(int sig)
+{
+	return sig > 31 && sig < SIGRTMIN;
+}
+
+static int get_signal_num(const char *name)
+{
+	size_t i;
+
+	if (name == NULL)
+		die(EXIT_ERR, "missing signal spec", NULL);
+
+	/* The leading "SIG" is optional. */
+	const char *s = tiny_startswith(name, "SIG") ? &name[3] : name;
+	for (i = 0; i < ARRAY_SIZE(signals); ++i)
+		if (tiny_streq(signals[i].name, s))
+			return signals[i].value;
+
+	if (tiny_startswith(s, "RTMIN")) {
+		if (s[5] == '\0')
+			return SIGRTMIN;
+		if (s[5] != '+')
+			die(EXIT_ERR, "must be SIGRTMIN or SIGRTMIN+<number>", NULL);
+		long adj = tiny_atoi(&s[6]);
+		if (adj > SIGRTMAX - SIGRTMIN)
+			die(EXIT_ERR, "SIGRTMIN offset too large", name);
+		return SIGRTMIN + adj;
+	} else if (tiny_startswith(s, "RTMAX")) {
+		if (s[5] == '\0')
+			return SIGRTMAX;
+		if (s[5] != '-')
+			die(EXIT_ERR, "must be SIGRTMAX or SIGRTMAX-<number>", NULL);
+		long adj = tiny_atoi(&s[6]);
+		if (adj > SIGRTMAX - SIGRTMIN)
+			die(EXIT_ERR, "SIGRTMAX offset too large", name);
+		return SIGRTMAX - adj;
+	}
+
+	/* Maybe it's a number. */
+	long signum = tiny_atoi(name);
+	if (signum > SIGRTMAX)
+		die(EXIT_ERR, "signal number too large", name);
+	return signum;
+}
+
+static void sigaction_range(unsigned long handler, int first, int last)
+{
+	struct ksigaction ksa;
+	int sig;
+
+	ksa.handler = handler;
+	ksa.flags = 0;
+	ksa.restorer = 0;
+	ksa.mask = 0;
+	for (sig = first; sig <= last; ++sig) {
+		if (sig_reserved(sig))
+			continue;
+		long ret = syscall4(SYS_rt_sigaction, sig, (long)&ksa, 0, sizeof(ksa.mask));
+		/* SIGKILL/SIGSTOP trigger EINVAL.  Ignore by default. */
+		if (ret && ret != -EINVAL)
+			warn_msg("sigaction() failed", NULL);
+	}
+}
+
+/* Signal sets are simple bitmasks for the kernel. */
+#define SIGBIT(sig) (1ULL << ((sig) - 1))
+static uint64_t sig_fill(void)
+{
+	return ~(SIGBIT(32) | SIGBIT(33));
+}
+
+static void sigprocmask(int how, uint64_t set)
+{
+	if (syscall4(SYS_rt_sigprocmask, how, (long)&set, 0, sizeof(set)))
+		warn_msg("sigprocmask() failed", NULL);
+}
+
+/* See the full nosig for why the ranges are inverted. */
+static void sigprocmask_range(int how, int first, int last)
+{
+	uint64_t set = sig_fill();
+	int sig;
+	for (sig = first; sig <= last; ++sig)
+		set &= ~SIGBIT(sig);
+	sigprocmask(how, set);
+}
+
+/*
+ * Program execution.
+ */
+static const char *env_get(char **envp, const char *var)
+{
+	size_t len = tiny_strlen(var);
+	for (; *envp; ++envp)
+		if (tiny_startswith(*envp, var) && (*envp)[len] == '=')
+			return &(*envp)[len + 1];
+	return NULL;
+}
+
+/* Try to run |path|.  Only returns on failure (the negative errno). */
+static long try_exec(const char *path, char **argv, char **envp)
+{
+	long ret = syscall3(SYS_execve, (long)path, (long)argv, (long)envp);
+	if (ret == -ENOEXEC) {
+		/* Run scripts without a shebang via the shell like execvp. */
+		size_t argc = 0;
+		while (argv[argc])
+			++argc;
+		char *sh_argv[argc + 2];
+		sh_argv[0] = (char *)"sh";
+		sh_argv[1] = (char *)path;
+		for (size_t i = 1; i <= argc; ++i)
+			sh_argv[i + 1] = argv[i];
+		ret = syscall3(SYS_execve, (long)"/bin/sh", (long)sh_argv, (long)envp);
+	}
+	return ret;
+}
+
+ATTR_NORETURN
+static void exec_prog(char **argv, char **envp)
+{
+	const char *prog = argv[0];
+	const char *p;
+	long ret;
+
+	for (p = prog; *p; ++p)
+		if (*p == '/')
+			break;
+	if (*p) {
+		ret = try_exec(prog, argv, envp);
+	} else {
+		/* Search $PATH like execvp. */
+		const char *path = env_get(envp, "PATH");
+		if (path == NULL)
+			path = "/bin:/usr/bin";
+		size_t prog_len = tiny_strlen(prog);
+		bool eacces = false;
+
+		/* Like execvp, skip dirs that don't have it, but stop on real errors. */
+		ret = -ENOENT;
+		while (true) {
+			const char *end = path;
+			while (*end && *end != ':')
+				++end;
+			size_t dir_len = end - path;
+
+			char buf[4096];
+			if (dir_len + prog_len + 2 <= sizeof(buf)) {
+				size_t i, len = 0;
+				for (i = 0; i < dir_len; ++i)
+					buf[len++] = path[i];
+				/* Empty components mean the current dir. */
+				if (dir_len)
+					buf[len++] = '/';
+				for (i = 0; i <= prog_len; ++i)
+					buf[len++] = prog[i];
+				ret = try_exec(buf, argv, envp);
+				if (ret == -EACCES)
+					eacces = true;
+				else if (ret != -ENOENT && ret != -ENOTDIR)
+					break;
+			}
+
+			if (*end == '\0') {
+				ret = eacces ? -EACCES : -ENOENT;
+				break;
+			}
+			path = end + 1;
+		}
+	}
+
+	/* Use exit status like POSIX/bash/nohup/env/etc... and the full nosig. */
+	die(ret == -ENOENT ? EXIT_PROG_NOT_FOUND :
+	    ret == -EACCES ? EXIT_PROG_NOT_EXEC : EXIT_ERR,
+	    "could not execute", prog);
+}
+
+/*
+ * Option parsing.  These mirror the full nosig signal options.
+ */
+enum {
+	OPT_RESET_ALL = 0x100,
+	OPT_IGNORE_ALL,
+	OPT_IGNORE_ALL_STD,
+	OPT_IGNORE_ALL_RT,
+	OPT_DEFAULT_ALL,
+	OPT_DEFAULT_ALL_STD,
+	OPT_DEFAULT_ALL_RT,
+	OPT_BLOCK_ALL,
+	OPT_BLOCK_ALL_STD,
+	OPT_BLOCK_ALL_RT,
+	OPT_UNBLOCK_ALL,
+	OPT_UNBLOCK_ALL_STD,
+	OPT_UNBLOCK_ALL_RT,
+};
+static const struct {
+	const char *name;
+	bool has_arg;
+	int val;
+} options[] = {
+	{ "reset",           false, OPT_RESET_ALL },
+	{ "ignore",          true,  'I' },
+	{ "ignore-all",      false, OPT_IGNORE_ALL },
+	{ "ignore-all-std",  false, OPT_IGNORE_ALL_STD },
+	{ "ignore-all-rt",   false, OPT_IGNORE_ALL_RT },
+	{ "default",         true,  'D' },
+	{ "default-all",     false, OPT_DEFAULT_ALL },
+	{ "default-all-std", false, OPT_DEFAULT_ALL_STD },
+	{ "default-all-rt",  false, OPT_DEFAULT_ALL_RT },
+	{ "add",             true,  'a' },
+	{ "del",             true,  'd' },
+	{ "empty",           false, 'e' },
+	{ "fill",            false, 'f' },
+	{ "block",           false, 'b' },
+	{ "unblock",         false, 'u' },
+	{ "set",             false, 's' },
+	{ "block-all",       false, OPT_BLOCK_ALL },
+	{ "block-all-std",   false, OPT_BLOCK_ALL_STD },
+	{ "block-all-rt",    false, OPT_BLOCK_ALL_RT },
+	{ "unblock-all",     false, OPT_UNBLOCK_ALL },
+	{ "unblock-all-std", false, OPT_UNBLOCK_ALL_STD },
+	{ "unblock-all-rt",  false, OPT_UNBLOCK_ALL_RT },
+};
+
+ATTR_NORETURN
+static void unsupported(const char *opt)
+{
+	die(EXIT_ERR, "unsupported option (use the full nosig)", opt);
+}
+
+/* Look up option |c| (short) or |name| (long). */
+static size_t find_option(int c, const char *name, size_t len)
+{
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(options); ++i) {
+		if (name) {
+			if (tiny_strlen(options[i].name) == len &&
+			    tiny_startswith(name, options[i].name))
+				return i;
+		} else if (options[i].val == c)
+			return i;
+	}
+	return i;
+}
+
+static uint64_t set;
+
+static void process_option(int opt, const char *arg)
+{
+	switch (opt) {
+	case OPT_RESET_ALL:
+		sigprocmask_range(SIG_UNBLOCK, 0, -1);
+		sigaction_range(KSIG_DFL, 1, SIGRTMAX);
+		break;
+
+	case 'I':
+		sigaction_range(KSIG_IGN, get_signal_num(arg), get_signal_num(arg));
+		break;
+	case OPT_IGNORE_ALL:
+		sigaction_range(KSIG_IGN, 1, SIGRTMAX);
+		break;
+	case OPT_IGNORE_ALL_STD:
+		sigaction_range(KSIG_IGN, 1, SIGRTMIN - 1);
+		break;
+	case OPT_IGNORE_ALL_RT:
+		sigaction_range(KSIG_IGN, SIGRTMIN, SIGRTMAX);
+		break;
+
+	case 'D':
+		sigaction_range(KSIG_DFL, get_signal_num(arg), get_signal_num(arg));
+		break;
+	case OPT_DEFAULT_ALL:
+		sigaction_range(KSIG_DFL, 1, SIGRTMAX);
+		break;
+	case OPT_DEFAULT_ALL_STD:
+		sigaction_range(KSIG_DFL, 1, SIGRTMIN - 1);
+		break;
+	case OPT_DEFAULT_ALL_RT:
+		sigaction_range(KSIG_DFL, SIGRTMIN, SIGRTMAX);
+		break;
+
+	case 'a': {
+		int sig = get_signal_num(arg);
+		if (sig && !sig_reserved(sig))
+			set |= SIGBIT(sig);
+		break;
+	}
+	case 'd': {
+		int sig = get_signal_num(arg);
+		if (sig)
+			set &= ~SIGBIT(sig);
+		break;
+	}
+	case 'e':
+		set = 0;
+		break;
+	case 'f':
+		set = sig_fill();
+		break;
+
+	case 'b':
+		sigprocmask(SIG_BLOCK, set);
+		break;
+	case 'u':
+		sigprocmask(SIG_UNBLOCK, set);
+		break;
+	case 's':
+		sigprocmask(SIG_SETMASK, set);
+		break;
+	case OPT_BLOCK_ALL:
+		sigprocmask_range(SIG_BLOCK, 0, -1);
+		break;
+	case OPT_BLOCK_ALL_STD:
+		sigprocmask_range(SIG_BLOCK, SIGRTMIN, SIGRTMAX);
+		break;
+	case OPT_BLOCK_ALL_RT:
+		sigprocmask_range(SIG_BLOCK, 1, SIGRTMIN - 1);
+		break;
+	case OPT_UNBLOCK_ALL:
+		sigprocmask_range(SIG_UNBLOCK, 0, -1);
+		break;
+	case OPT_UNBLOCK_ALL_STD:
+		sigprocmask_range(SIG_UNBLOCK, SIGRTMIN, SIGRTMAX);
+		break;
+	case OPT_UNBLOCK_ALL_RT:
+		sigprocmask_range(SIG_UNBLOCK, 1, SIGRTMIN - 1);
+		break;
+	}
+}
+
+ATTR_NORETURN __attribute__((__used__))
+void tiny_main(long *sp)
+{
+	int argc = sp[0];
+	char **argv = (char **)&sp[1];
+	char **envp = &argv[argc + 1];
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		char *arg = argv[i];
+		size_t o;
+
+		if (arg[0] != '-' || arg[1] == '\0')
+			break;
+
+		if (arg[1] == '-') {
+			if (arg[2] == '\0') {
+				++i;
+				break;
+			}
+
+			/* Long options: --name, --name=arg, or --name arg. */
+			const char *name = &arg[2], *val = NULL;
+			size_t len = 0;
+			while (name[len] && name[len] != '=')
+				++len;
+			if (name[len] == '=')
+				val = &name[len + 1];
+			o = find_option(0, name, len);
+			if (o == ARRAY_SIZE(options))
+				unsupported(arg);
+			if (options[o].has_arg) {
+				if (val == NULL)
+					val = argv[++i];
+			} else if (val)
+				die(EXIT_ERR, "option doesn't allow an argument", arg);
+			process_option(options[o].val, val);
+			continue;
+		}
+
+		/* Short options: -x, -xarg, -x arg, or bundles like -ef. */
+		for (++arg; *arg; ++arg) {
+			o = find_option(*arg, NULL, 0);
+			if (o == ARRAY_SIZE(options))
+				unsupported(argv[i]);
+			if (options[o].has_arg) {
+				const char *val = arg[1] ? &arg[1] : argv[++i];
+				process_option(options[o].val, val);
+				break;
+			}
+			process_option(options[o].val, NULL);
+		}
+	}
+
+	if (i >= argc)
+		die(EXIT_ERR, "missing program to run", NULL);
+	exec_prog(&argv[i], envp);
+}
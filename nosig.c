@@ -6,31 +6,55 @@
  */
 
 #include <assert.h>
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __linux__
+# include <elf.h>
+# include <sys/mman.h>
+# include <sys/prctl.h>
+# include <sys/ptrace.h>
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+# include "linux.h"
+#endif
 
-#define HOMEPAGE "https://github.com/vapier/nosig/"
+#include "signames.h"
 
-/* macOS doesn't support realtime signals as they were optional. */
-#if defined(SIGRTMIN) && defined(SIGRTMAX)
-# define USE_RT 1
-#else
-# define USE_RT 0
-#endif
+#define HOMEPAGE "https://github.com/vapier/nosig/"
 
 /*
  * Some random global variables.  Should limit this.
  */
 static size_t verbose = 0;
 
+/* The environment to pass to the program.  NULL means use environ as-is. */
+extern char **environ;
+static char **envp = NULL;
+static size_t env_cnt = 0;
+
 /*
  * Exit statuses to use.
  * Make sure to never use any other value (e.g. "0" or "1").
@@ -64,104 +88,42 @@ static long xatoi(const char *s, int base)
 	return ret;
 }
 
+/* Convert a size with an optional k/m/g (base 1024) suffix into bytes. */
+static size_t xatosize(const char *s)
+{
+	char *end;
+	unsigned long long ret = strtoull(s, &end, 10);
+	int shift = 0;
+
+	if (end == s || *s == '-')
+		errx(EXIT_ERR, "error: could not decode size: %s", s);
+	switch (*end) {
+	case 'g': case 'G': shift += 10; /* fallthrough */
+	case 'm': case 'M': shift += 10; /* fallthrough */
+	case 'k': case 'K': shift += 10; ++end; break;
+	}
+	if (*end || ret > (SIZE_MAX >> shift))
+		errx(EXIT_ERR, "error: could not decode size: %s", s);
+	return ret << shift;
+}
+
+/* Parse a single number or range like "4-7" (modifies |tok|). */
+static void parse_range(char *tok, long *first, long *last)
+{
+	char *dash = strchr(tok, '-');
+	if (dash && dash != tok) {
+		*dash = '\0';
+		*first = xatoi(tok, 10);
+		*last = xatoi(dash + 1, 10);
+	} else
+		*first = *last = xatoi(tok, 10);
+}
+
 struct pair {
 	const char *name;
 	int value;
 };
 
-/*
- * List of all signals binding symbolic names to numerical value.
- *
- * This is sorted somewhat arbitrarily so the number value is in order on an
- * x86_64/Linux system so the list_signals function displays in order.  Probably
- * should improve that function to do dynamic sorting itself at some point.
- * It's also sorted to give priority for certain signal names over others when
- * the names resolve to the same number.
- *
- * ifdef protection is used only for signal names not defined by POSIX.
- * https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/signal.h.html
- * Non-POSIX targets are a non-goal of the project (i.e. Windows).  Additional
- * non-standard signals may be added if they're used by a common OS (i.e. BSD).
- *
- * NB: In a pinch, users may always user a signal by number, so listing the
- * symbolic name here is not super critical to use.
- *
- * NB: SIGRT{MIN,MAX} as specifically omitted from this list.  This only tracks
- * constant signals and SIGRT{MIN,MAX} are allowed to be dynamic as the OS is
- * allowed to reserve from that range thereby adjusting their value.  We parse
- * those signal names on the fly rather than use a lookup table.
- */
-#define P(s) { #s, s }
-static const struct pair signals[] = {
-	P(SIGHUP),
-	P(SIGINT),
-	P(SIGQUIT),
-	P(SIGILL),
-	P(SIGTRAP),
-	P(SIGABRT),
-#ifdef SIGIOT
-	P(SIGIOT),
-#endif
-	P(SIGBUS),
-	P(SIGFPE),
-	P(SIGKILL),
-	P(SIGUSR1),
-	P(SIGSEGV),
-	P(SIGUSR2),
-	P(SIGPIPE),
-	P(SIGALRM),
-	P(SIGTERM),
-#ifdef SIGSTKFLT
-	P(SIGSTKFLT),
-#endif
-	P(SIGCHLD),
-	P(SIGCONT),
-	P(SIGSTOP),
-	P(SIGTSTP),
-	P(SIGTTIN),
-	P(SIGTTOU),
-	P(SIGURG),
-	P(SIGXCPU),
-	P(SIGXFSZ),
-	P(SIGVTALRM),
-	P(SIGPROF),
-#ifdef SIGWINCH
-	P(SIGWINCH),
-#endif
-#ifdef SIGIO
-	P(SIGIO),
-#endif
-	P(SIGPOLL),
-#ifdef SIGPWR
-	P(SIGPWR),
-#endif
-	P(SIGSYS),
-#ifdef SIGEMT
-	P(SIGEMT),
-#endif
-#ifdef SIGUNUSED
-	P(SIGUNUSED),
-#endif
-};
-#undef P
-
-/* POSIX does not make it easy to figure out how many signals are supported. */
-static int get_sigmax(void)
-{
-#if USE_RT
-	return SIGRTMAX;
-#else
-	size_t i;
-	int sig = 1;
-
-	for (i = 0; i < ARRAY_SIZE(signals); ++i)
-		if (sig < signals[i].value)
-			sig = signals[i].value;
-
-	return sig;
-#endif
-}
-
 /* Turn a symbolic signal name from the user into a signal number. */
 static int get_signal_num(const char *name)
 {
@@ -174,7 +136,7 @@ static int get_signal_num(const char *name)
 	off = (strncmp(name, "SIG", 3) == 0) ? 0 : 3;
 
 	/* Look up the name in the signal table. */
-	for (i = 0; i < ARRAY_SIZE(signals); ++i)
+	for (i = 0; i < signals_cnt; ++i)
 		if (streq(&signals[i].name[off], name))
 			return signals[i].value;
 
@@ -212,151 +174,2936 @@ static int get_signal_num(const char *name)
 	}
 #endif
 
-	/* Maybe it's a number. */
-	long signum = xatoi(name, 10);
-	if (signum < 0)
-		errx(EXIT_ERR, "only positive integers are allowed: %s", name);
-	if (signum > get_sigmax())
-		errx(EXIT_ERR, "signals greater than %i not supported", get_sigmax());
-	return signum;
+	/* Maybe it's a number. */
+	long signum = xatoi(name, 10);
+	if (signum < 0)
+		errx(EXIT_ERR, "only positive integers are allowed: %s", name);
+	if (signum > get_sigmax())
+		errx(EXIT_ERR, "signals greater than %i not supported", get_sigmax());
+	return signum;
+}
+
+/*
+ * Helpers to set signal dispositions via sigaction.
+ *
+ * Passing sa_handler/SIG_IGN/SIG_DFL as an argument is difficult due to lack
+ * of a standard typedef in POSIX.  Let the compiler deal with optimization :P.
+ */
+static void _sigaction_range(struct sigaction *sa, int first, int last)
+{
+	int sig;
+	for (sig = first; sig <= last; ++sig) {
+		if (sigaction(sig, sa, NULL)) {
+			/* SIGKILL/SIGSTOP trigger EINVAL.  Ignore by default. */
+			if (verbose || errno != EINVAL)
+				warn("sigaction(%s[%i]) failed", strsigname(sig), sig);
+		}
+	}
+}
+static void set_sigaction_ignore_range(struct sigaction *sa, int first, int last)
+{
+	sa->sa_handler = SIG_IGN;
+	_sigaction_range(sa, first, last);
+}
+static void set_sigaction_ignore(struct sigaction *sa, int sig)
+{
+	set_sigaction_ignore_range(sa, sig, sig);
+}
+static void set_sigaction_default_range(struct sigaction *sa, int first, int last)
+{
+	sa->sa_handler = SIG_DFL;
+	_sigaction_range(sa, first, last);
+}
+static void set_sigaction_default(struct sigaction *sa, int sig)
+{
+	set_sigaction_default_range(sa, sig, sig);
+}
+
+/*
+ * Helpers to set signal block masks.
+ *
+ * NB: The meaning of first/last is inverted from sigaction_range.  We use
+ * sigfillset and then remove the [first,last] range rather than sigemptyset
+ * and then adding the range.  This gives the C library a chance to filter out
+ * any reserved realtime signals it might have.  This way our --block-all opts
+ * will match behavior with manual --fill --block settings.
+ */
+static void sigprocmask_range(int how, int first, int last)
+{
+	int sig;
+	sigset_t set;
+	sigfillset(&set);
+	for (sig = first; sig <= last; ++sig)
+		sigdelset(&set, sig);
+	if (sigprocmask(how, &set, 0))
+		warn("sigprocmask_range()");
+}
+
+/* Rebind |fd| to |path| using file |flags|. */
+static void redirect_io(int oldfd, const char *path, int flags)
+{
+	/* NB: dup2 always clears O_CLOEXEC, so we have to reset it ourselves. */
+	bool cloexec = flags & O_CLOEXEC;
+
+	/* We use mode 666 to let umask apply. */
+	int newfd = open(path, flags, 0666);
+	if (newfd < 0)
+		err(EXIT_ERR, "could not open %s", path);
+	/* Pathological edge case: if newfd is already oldfd, do nothing. */
+	if (newfd != oldfd) {
+		if (dup2(newfd, oldfd) == -1)
+			err(EXIT_ERR, "could not dup to %i", oldfd);
+		close(newfd);
+		if (cloexec && fcntl(oldfd, F_SETFD, FD_CLOEXEC))
+			err(EXIT_ERR, "could not set close-on-exec on %i", oldfd);
+	}
+}
+static void redirect_input_from(const char *path)
+{
+	redirect_io(0, path, O_RDONLY);
+}
+static void redirect_output_to(int oldfd, const char *path)
+{
+	redirect_io(oldfd, path, O_WRONLY|O_CREAT|O_TRUNC);
+}
+
+/*
+ * List of open(2) flags users may specify via --fd.
+ *
+ * ifdef protection is used only for flags not defined by POSIX.  The Linux
+ * specific ones (direct & noatime) are handled by linux_open_flag.
+ */
+#define P(name, flag) { name, flag }
+static const struct pair open_flags[] = {
+	P("rdonly", O_RDONLY),
+	P("wronly", O_WRONLY),
+	P("rdwr", O_RDWR),
+	P("append", O_APPEND),
+	P("creat", O_CREAT),
+	P("excl", O_EXCL),
+	P("trunc", O_TRUNC),
+	P("cloexec", O_CLOEXEC),
+	P("nofollow", O_NOFOLLOW),
+	P("nonblock", O_NONBLOCK),
+	P("sync", O_SYNC),
+#ifdef O_DSYNC
+	P("dsync", O_DSYNC),
+#endif
+};
+#undef P
+
+/*
+ * Parse a comma separated list of |open_flags| names.
+ * Returns false if any of them are unknown.
+ */
+static bool parse_open_flags(const char *list, int *flags)
+{
+	const char *p = list;
+	size_t i;
+#ifdef __linux__
+	int flag;
+#endif
+
+	*flags = 0;
+	while (*p) {
+		size_t len = strcspn(p, ",");
+		for (i = 0; i < ARRAY_SIZE(open_flags); ++i)
+			if (strlen(open_flags[i].name) == len &&
+			    strncmp(open_flags[i].name, p, len) == 0)
+				break;
+		if (i < ARRAY_SIZE(open_flags))
+			*flags |= open_flags[i].value;
+#ifdef __linux__
+		/* The Linux specific flags are GNU extensions, so they live there. */
+		else if ((flag = linux_open_flag(p, len)) != 0)
+			*flags |= flag;
+#endif
+		else
+			return false;
+		p += len;
+		if (*p == ',')
+			++p;
+	}
+
+	/* Writing modifiers without an explicit mode mean writing. */
+	if ((*flags & O_ACCMODE) == O_RDONLY && (*flags & (O_APPEND|O_CREAT|O_TRUNC)))
+		*flags |= O_WRONLY;
+
+	return true;
+}
+
+/*
+ * Split the optional trailing ":flags" off |arg| (see parse_open_flags).
+ * Returns the malloc-ed path and the flags to use (or |default_flags|).
+ */
+static char *split_path_flags(const char *arg, int *flags, int default_flags)
+{
+	char *path = strdup(arg);
+	if (path == NULL)
+		err(EXIT_ERR, "strdup() failed");
+
+	/* Flags are optional, so only split them off if they look valid. */
+	char *colon = strrchr(path, ':');
+	if (colon && parse_open_flags(colon + 1, flags))
+		*colon = '\0';
+	else
+		*flags = default_flags;
+
+	return path;
+}
+
+/* The lowest fd (above stdio) set up by --fd so --listen doesn't clobber it. */
+static int min_setup_fd = INT_MAX;
+static void move_listen_fd(int fd);
+
+/*
+ * Set up an arbitrary fd.  The |spec| takes the forms:
+ *   N=fd:M          Duplicate fd M to fd N.
+ *   N=path[:flags]  Open path (read-only by default) as fd N.
+ */
+static void setup_fd(const char *spec)
+{
+	char *end;
+	long fd = strtol(spec, &end, 10);
+	if (end == spec || *end != '=' || fd < 0 || fd > INT_MAX)
+		errx(EXIT_ERR, "invalid fd spec (must be N=...): %s", spec);
+	const char *arg = end + 1;
+
+	if (fd > 2 && fd < min_setup_fd)
+		min_setup_fd = fd;
+	move_listen_fd(fd);
+
+	if (strncmp(arg, "fd:", 3) == 0) {
+		long oldfd = xatoi(&arg[3], 10);
+		if (oldfd < 0 || oldfd > INT_MAX)
+			errx(EXIT_ERR, "invalid fd: %s", &arg[3]);
+		if (oldfd != fd && dup2(oldfd, fd) == -1)
+			err(EXIT_ERR, "could not dup %li to %li", oldfd, fd);
+		return;
+	}
+
+	int flags;
+	char *path = split_path_flags(arg, &flags, O_RDONLY);
+	redirect_io(fd, path, flags);
+	free(path);
+}
+
+#ifdef __linux__
+/*
+ * Resize stdout/stderr if they're pipes.  The default (64KiB on Linux) means a
+ * lot of context switching for programs that write a lot of output.
+ */
+static void set_pipe_size(const char *arg)
+{
+	size_t size = xatosize(arg);
+	int fd;
+
+	if (size > INT_MAX)
+		errx(EXIT_ERR, "pipe size too large: %s", arg);
+
+	for (fd = 1; fd <= 2; ++fd) {
+		struct stat st;
+		if (fstat(fd, &st) || !S_ISFIFO(st.st_mode))
+			continue;
+		if (linux_set_pipe_size(fd, (int)size) < 0)
+			warn("could not set pipe size of fd %i to %zu", fd, size);
+	}
+}
+#endif
+
+/*
+ * Helpers to manage the environment passed to the program.
+ *
+ * We build up our own copy rather than use setenv/unsetenv so we can pass it
+ * directly to execve when we're done, and we never modify our own settings.
+ */
+static void env_init(void)
+{
+	size_t i, cnt;
+
+	if (envp)
+		return;
+
+	for (cnt = 0; environ[cnt]; ++cnt)
+		continue;
+	envp = malloc(sizeof(*envp) * (cnt + 1));
+	if (envp == NULL)
+		err(EXIT_ERR, "malloc() failed");
+	for (i = 0; i < cnt; ++i)
+		envp[i] = environ[i];
+	envp[cnt] = NULL;
+	env_cnt = cnt;
+}
+/* Return the index of |name| (of |len| bytes) in the env, or -1 if unset. */
+static ssize_t env_find(const char *name, size_t len)
+{
+	size_t i;
+	for (i = 0; i < env_cnt; ++i)
+		if (strncmp(envp[i], name, len) == 0 && envp[i][len] == '=')
+			return i;
+	return -1;
+}
+static const char *env_get(const char *name)
+{
+	if (envp == NULL)
+		return getenv(name);
+	ssize_t i = env_find(name, strlen(name));
+	return i < 0 ? NULL : &envp[i][strlen(name) + 1];
+}
+static void env_unset(const char *name)
+{
+	if (*name == '\0' || strchr(name, '='))
+		errx(EXIT_ERR, "cannot unset invalid name: %s", name);
+
+	env_init();
+	ssize_t i = env_find(name, strlen(name));
+	if (i >= 0) {
+		memmove(&envp[i], &envp[i + 1], sizeof(*envp) * (env_cnt - i));
+		--env_cnt;
+	}
+}
+/* Set |str| which is of the form NAME=VALUE. */
+static void env_set(char *str)
+{
+	const char *eq = strchr(str, '=');
+	if (eq == NULL || eq == str)
+		errx(EXIT_ERR, "invalid environment setting: %s", str);
+
+	env_init();
+	ssize_t i = env_find(str, eq - str);
+	if (i >= 0) {
+		envp[i] = str;
+		return;
+	}
+	char **new_envp = realloc(envp, sizeof(*envp) * (env_cnt + 2));
+	if (new_envp == NULL)
+		err(EXIT_ERR, "realloc() failed");
+	envp = new_envp;
+	envp[env_cnt++] = str;
+	envp[env_cnt] = NULL;
+}
+static void env_clear(void)
+{
+	env_init();
+	env_cnt = 0;
+	envp[0] = NULL;
+}
+
+/*
+ * Find |prog| in |path| using the same rules as execvp.
+ * Returns a malloc-ed path on success, or NULL & sets errno on failure.
+ */
+static char *find_in_path(const char *prog, const char *path)
+{
+	/* Paths with a slash are used as-is and never searched. */
+	if (strchr(prog, '/'))
+		return strdup(prog);
+
+	if (path == NULL)
+		path = "/bin:/usr/bin";
+
+	size_t prog_len = strlen(prog);
+	char *buf = malloc(strlen(path) + prog_len + 2);
+	if (buf == NULL)
+		return NULL;
+
+	int ret_errno = ENOENT;
+	while (true) {
+		const char *end = strchr(path, ':');
+		size_t len = end ? (size_t)(end - path) : strlen(path);
+
+		/* An empty element means the current directory. */
+		memcpy(buf, path, len);
+		if (len)
+			buf[len++] = '/';
+		memcpy(&buf[len], prog, prog_len + 1);
+
+		struct stat st;
+		if (stat(buf, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (access(buf, X_OK) == 0)
+				return buf;
+			ret_errno = EACCES;
+		}
+
+		if (end == NULL)
+			break;
+		path = end + 1;
+	}
+
+	free(buf);
+	errno = ret_errno;
+	return NULL;
+}
+
+/* Explicit program to run rather than searching $PATH. */
+static char *exec_path = NULL;
+static int exec_fd = -1;
+
+/*
+ * The last program we resolved via $PATH.  We need it for both the nested
+ * invocation check & the final exec, and walking $PATH can be slow when it
+ * has a lot of entries (especially on network filesystems).
+ */
+static struct {
+	char *prog;
+	char *search;
+	char *path;
+} prog_cache;
+
+static void prog_cache_flush(void)
+{
+	free(prog_cache.prog);
+	free(prog_cache.search);
+	free(prog_cache.path);
+	memset(&prog_cache, 0, sizeof(prog_cache));
+}
+
+/* Find the file to run for |prog|.  Returns NULL & sets errno on failure. */
+static const char *resolve_prog(const char *prog)
+{
+	if (exec_path)
+		return exec_path;
+
+	const char *search = env_get("PATH");
+	if (prog_cache.path && streq(prog_cache.prog, prog) &&
+	    (search ? prog_cache.search && streq(prog_cache.search, search) :
+	              prog_cache.search == NULL))
+		return prog_cache.path;
+
+	char *path = find_in_path(prog, search);
+	if (path == NULL)
+		return NULL;
+
+	prog_cache_flush();
+	prog_cache.prog = strdup(prog);
+	prog_cache.search = search ? strdup(search) : NULL;
+	prog_cache.path = path;
+	if (prog_cache.prog == NULL || (search && prog_cache.search == NULL))
+		err(EXIT_ERR, "strdup() failed");
+	return path;
+}
+
+/* See whether |prog| (as execvp would find it) is this nosig program. */
+static bool is_self(const char *argv0, const char *prog)
+{
+	struct stat self_st, prog_st;
+	const char *path;
+
+	/* Linux makes this easy.  Otherwise fallback to how we were run. */
+	if (stat("/proc/self/exe", &self_st)) {
+		char *self = find_in_path(argv0, getenv("PATH"));
+		if (self == NULL)
+			return false;
+		int ret = stat(self, &self_st);
+		free(self);
+		if (ret)
+			return false;
+	}
+
+	if (exec_fd >= 0) {
+		if (fstat(exec_fd, &prog_st))
+			return false;
+	} else {
+		path = resolve_prog(prog);
+		if (path == NULL || stat(path, &prog_st))
+			return false;
+	}
+
+	return self_st.st_dev == prog_st.st_dev && self_st.st_ino == prog_st.st_ino;
+}
+
+/*
+ * Run |argv| like execvp, but with our own environment.  Only returns on
+ * failure with errno set.
+ */
+static void exec_prog(char *argv[])
+{
+	char **env = envp ? envp : environ;
+
+	if (exec_fd >= 0) {
+#ifdef __linux__
+		fexecve(exec_fd, argv, env);
+#else
+		/* Not everyone has fexecve (e.g. macOS), but most have /dev/fd. */
+		char fdpath[32];
+		snprintf(fdpath, sizeof(fdpath), "/dev/fd/%i", exec_fd);
+		execve(fdpath, argv, env);
+#endif
+		return;
+	}
+
+	const char *path = resolve_prog(argv[0]);
+	if (path == NULL)
+		return;
+
+	execve(path, argv, env);
+
+	/* The cached path might have gone stale, so search one more time. */
+	if (errno == ENOENT && exec_path == NULL) {
+		prog_cache_flush();
+		path = resolve_prog(argv[0]);
+		if (path == NULL)
+			return;
+		execve(path, argv, env);
+	}
+
+	/* Like execvp, run files without a shebang via the shell. */
+	if (errno == ENOEXEC) {
+		size_t argc;
+		for (argc = 0; argv[argc]; ++argc)
+			continue;
+		char **sh_argv = malloc(sizeof(*sh_argv) * (argc + 2));
+		if (sh_argv == NULL)
+			return;
+		sh_argv[0] = (char *)"/bin/sh";
+		sh_argv[1] = (char *)path;
+		memcpy(&sh_argv[2], &argv[1], sizeof(*argv) * argc);
+		execve(sh_argv[0], sh_argv, env);
+		errno = ENOEXEC;
+	}
+}
+
+/*
+ * Split |str| into words like env -S and splice them into the argv array in
+ * place of the already processed options.  This lets people write shebangs
+ * like "#!/usr/bin/nosig -S --ignore HUP --" as the kernel passes everything
+ * after the interpreter as a single argument.
+ *
+ * Words are separated by whitespace.  Single quotes preserve everything
+ * literally, while double quotes & unquoted text allow backslash escapes.
+ */
+static void split_args(int *argc, char ***argv, int optind_, const char *str)
+{
+	/* Every word needs at least one char & one separator, so this is enough. */
+	size_t max_words = strlen(str) / 2 + 1;
+	char **new_argv = malloc(sizeof(*new_argv) * (max_words + *argc + 1));
+	char *buf = malloc(strlen(str) + 1);
+	if (new_argv == NULL || buf == NULL)
+		err(EXIT_ERR, "malloc() failed");
+
+	int new_argc = 0;
+	new_argv[new_argc++] = (*argv)[0];
+
+	const char *p = str;
+	char *word = buf, *out = buf;
+	while (true) {
+		/* Skip leading whitespace. */
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			++p;
+		if (*p == '\0')
+			break;
+
+		char quote = '\0';
+		for (; *p; ++p) {
+			if (quote == '\'') {
+				if (*p == '\'')
+					quote = '\0';
+				else
+					*out++ = *p;
+			} else if (*p == '\\') {
+				if (p[1] == '\0')
+					errx(EXIT_ERR, "-S: trailing backslash: %s", str);
+				*out++ = *++p;
+			} else if (quote == '"') {
+				if (*p == '"')
+					quote = '\0';
+				else
+					*out++ = *p;
+			} else if (*p == '\'' || *p == '"') {
+				quote = *p;
+			} else if (*p == ' ' || *p == '\t' || *p == '\n') {
+				break;
+			} else
+				*out++ = *p;
+		}
+		if (quote)
+			errx(EXIT_ERR, "-S: unterminated quote: %s", str);
+
+		*out++ = '\0';
+		new_argv[new_argc++] = word;
+		word = out;
+	}
+
+	/* Then append all the arguments we haven't processed yet. */
+	while (optind_ < *argc)
+		new_argv[new_argc++] = (*argv)[optind_++];
+	new_argv[new_argc] = NULL;
+
+	*argc = new_argc;
+	*argv = new_argv;
+}
+
+/* Wait for the child |pid| to finish and return its exit status. */
+static int wait_child(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			err(EXIT_ERR, "waitpid(%i) failed", (int)pid);
+
+	return status;
+}
+
+/*
+ * Exit with the same |status| as a child.  If it was killed by a signal, we
+ * kill ourselves the same way so our parent can't tell the difference.
+ */
+ATTR_NORETURN
+static void exit_like(int status)
+{
+	if (WIFSIGNALED(status)) {
+		int sig = WTERMSIG(status);
+		struct sigaction sa;
+		sigset_t set;
+
+		/* Don't let the child's crash look like ours. */
+		struct rlimit rlim = { 0, 0 };
+		setrlimit(RLIMIT_CORE, &rlim);
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigaction(sig, &sa, NULL);
+		sigemptyset(&set);
+		sigaddset(&set, sig);
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		raise(sig);
+
+		/* Should never get here, but just in case. */
+		exit(128 + sig);
+	}
+
+	exit(WEXITSTATUS(status));
+}
+
+/* Wait for the child |pid| to finish, then exit with the same status. */
+ATTR_NORETURN
+static void wait_and_exit(pid_t pid)
+{
+	exit_like(wait_child(pid));
+}
+
+/* The --cgroup we still need to move into (if any). */
+static int cgroup_fd = -1;
+
+/* Remember the cgroup to run in.  We move into it as late as possible. */
+static void set_cgroup(const char *path)
+{
+	int fd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd < 0)
+		err(EXIT_ERR, "could not open cgroup %s", path);
+	if (faccessat(fd, "cgroup.procs", W_OK, 0))
+		err(EXIT_ERR, "not a usable cgroup: %s", path);
+	if (cgroup_fd >= 0)
+		close(cgroup_fd);
+	cgroup_fd = fd;
+}
+
+/* Move ourselves into the --cgroup right before running the program. */
+static void enter_cgroup(void)
+{
+	int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY|O_TRUNC|O_CLOEXEC);
+	if (fd < 0 || dprintf(fd, "%li\n", (long)getpid()) < 0)
+		err(EXIT_ERR, "could not move into cgroup");
+	close(fd);
+	close(cgroup_fd);
+	cgroup_fd = -1;
+}
+
+#if defined(__linux__) && defined(SYS_clone3)
+/* C libraries don't all provide this (or a wrapper), so use our own. */
+# define NOSIG_CLONE_INTO_CGROUP 0x200000000ULL
+struct nosig_clone_args {
+	uint64_t flags;
+	uint64_t pidfd;
+	uint64_t child_tid;
+	uint64_t parent_tid;
+	uint64_t exit_signal;
+	uint64_t stack;
+	uint64_t stack_size;
+	uint64_t tls;
+	uint64_t set_tid;
+	uint64_t set_tid_size;
+	uint64_t cgroup;
+};
+#endif
+
+/*
+ * Like fork, but start the child directly in the --cgroup (if any) so it never
+ * runs (or gets accounted) outside of it.  The parent stays where it is.
+ */
+static pid_t fork_child(void)
+{
+#if defined(__linux__) && defined(SYS_clone3)
+	if (cgroup_fd >= 0) {
+		struct nosig_clone_args args;
+		memset(&args, 0, sizeof(args));
+		args.flags = NOSIG_CLONE_INTO_CGROUP;
+		args.exit_signal = SIGCHLD;
+		args.cgroup = cgroup_fd;
+		long pid = linux_syscall(SYS_clone3, (long)&args, sizeof(args), 0);
+		if (pid == 0) {
+			close(cgroup_fd);
+			cgroup_fd = -1;
+			return 0;
+		} else if (pid > 0)
+			return pid;
+		/* Old kernels & non-cgroup2 paths fail, so the child moves itself later. */
+	}
+#endif
+	return fork();
+}
+
+/*
+ * If SIGCHLD is ignored (e.g. via --ignore-all), children are reaped as soon as
+ * they exit, and we can't wait for them.  Use the default while we need to, and
+ * save the user's setting in |old| so it can be restored for the program.
+ */
+static void sigchld_default(struct sigaction *old)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGCHLD, &sa, old);
+}
+
+static void sigchld_restore(const struct sigaction *old)
+{
+	sigaction(SIGCHLD, old, NULL);
+}
+
+/* Fork off a child to carry on.  The parent waits for it & never returns. */
+static void fork_and_wait(void)
+{
+	struct sigaction old;
+	sigchld_default(&old);
+	pid_t pid = fork_child();
+	if (pid < 0)
+		err(EXIT_ERR, "fork() failed");
+	else if (pid)
+		wait_and_exit(pid);
+	sigchld_restore(&old);
+}
+
+/*
+ * State for supervising a child.  The parent forwards signals sent directly to
+ * it (e.g. via kill) to the child, and gets notified via a pipe when the child
+ * exits so it can poll other fds at the same time.
+ */
+static pid_t supervised_pid = -1;
+static int supervisor_pipe[2] = { -1, -1 };
+static const int supervisor_signals[] = { SIGCHLD, SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+
+static void supervisor_signal(int sig, siginfo_t *info, void *context)
+{
+	int saved_errno = errno;
+	(void)context;
+
+	if (sig == SIGCHLD) {
+		ssize_t ret = write(supervisor_pipe[1], "", 1);
+		(void)ret;
+	} else if (info->si_code == SI_USER || info->si_code == SI_QUEUE) {
+		/* Signals from the terminal already went to the whole process group. */
+		kill(supervised_pid, sig);
+	}
+
+	errno = saved_errno;
+}
+
+/*
+ * Fork a child to carry on while the parent supervises it.
+ * Returns the child's pid in the parent, and 0 in the child.
+ */
+static pid_t start_supervised(void)
+{
+	sigset_t set, oldset;
+	size_t i;
+	int fd;
+
+	/* Don't miss SIGCHLD if the child exits before we're ready. */
+	sigemptyset(&set);
+	for (i = 0; i < ARRAY_SIZE(supervisor_signals); ++i)
+		sigaddset(&set, supervisor_signals[i]);
+	sigprocmask(SIG_BLOCK, &set, &oldset);
+	/* Blocking isn't enough if it's ignored as the child is reaped right away. */
+	struct sigaction old;
+	sigchld_default(&old);
+
+	pid_t pid = fork_child();
+	if (pid < 0)
+		err(EXIT_ERR, "fork() failed");
+	if (pid == 0) {
+		sigchld_restore(&old);
+		sigprocmask(SIG_SETMASK, &oldset, NULL);
+		return 0;
+	}
+	supervised_pid = pid;
+
+	if (pipe(supervisor_pipe))
+		err(EXIT_ERR, "pipe() failed");
+	for (i = 0; i < 2; ++i) {
+		fd = supervisor_pipe[i];
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = supervisor_signal;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigfillset(&sa.sa_mask);
+	for (i = 0; i < ARRAY_SIZE(supervisor_signals); ++i)
+		sigaction(supervisor_signals[i], &sa, NULL);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+
+	return pid;
+}
+
+/* See whether the supervised child has exited yet (and get its |status|). */
+static bool supervised_exited(int *status)
+{
+	char buf[64];
+	while (read(supervisor_pipe[0], buf, sizeof(buf)) > 0)
+		continue;
+	return waitpid(supervised_pid, status, WNOHANG) == supervised_pid;
+}
+
+/* Run in a new session without a controlling terminal like setsid(1). */
+static void start_session(void)
+{
+	/* Process group leaders aren't allowed to start new sessions. */
+	if (getpgrp() == getpid())
+		fork_and_wait();
+	if (setsid() < 0)
+		err(EXIT_ERR, "setsid() failed");
+}
+
+/* Run in a new process group. */
+static void start_process_group(void)
+{
+	if (setpgid(0, 0))
+		err(EXIT_ERR, "setpgid() failed");
+}
+
+/* Make our process group the foreground one on the controlling terminal. */
+static void set_foreground(void)
+{
+	int fd = open("/dev/tty", O_RDWR|O_CLOEXEC);
+	if (fd < 0)
+		err(EXIT_ERR, "could not open controlling terminal");
+
+	/*
+	 * Background process groups get SIGTTOU when calling tcsetpgrp, so block
+	 * it temporarily.  This leaves the user's settings alone for the program.
+	 */
+	sigset_t set, oldset;
+	sigemptyset(&set);
+	sigaddset(&set, SIGTTOU);
+	sigprocmask(SIG_BLOCK, &set, &oldset);
+	if (tcsetpgrp(fd, getpgrp()))
+		err(EXIT_ERR, "tcsetpgrp() failed");
+	sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+	close(fd);
+}
+
+/*
+ * List of resource limits for --rlimit.
+ *
+ * ifdef protection is used only for limits not defined by POSIX.
+ */
+#define P(name) { #name, RLIMIT_##name }
+static const struct pair rlimits[] = {
+	P(AS),
+	P(CORE),
+	P(CPU),
+	P(DATA),
+	P(FSIZE),
+	P(NOFILE),
+	P(STACK),
+#ifdef RLIMIT_MEMLOCK
+	P(MEMLOCK),
+#endif
+#ifdef RLIMIT_MSGQUEUE
+	P(MSGQUEUE),
+#endif
+#ifdef RLIMIT_NICE
+	P(NICE),
+#endif
+#ifdef RLIMIT_NPROC
+	P(NPROC),
+#endif
+#ifdef RLIMIT_RSS
+	P(RSS),
+#endif
+#ifdef RLIMIT_RTPRIO
+	P(RTPRIO),
+#endif
+#ifdef RLIMIT_RTTIME
+	P(RTTIME),
+#endif
+#ifdef RLIMIT_SIGPENDING
+	P(SIGPENDING),
+#endif
+};
+#undef P
+
+/* Parse a single limit value.  Empty means leave |*lim| alone. */
+static void parse_rlim(const char *s, rlim_t *lim)
+{
+	if (*s == '\0')
+		return;
+	if (strcasecmp(s, "unlimited") == 0 || strcasecmp(s, "infinity") == 0)
+		*lim = RLIM_INFINITY;
+	else
+		*lim = xatosize(s);
+}
+
+/*
+ * Set a resource limit.  The |spec| takes the form NAME=SOFT[:HARD] where
+ * NAME is like NOFILE or RLIMIT_NOFILE.  Omitted values are left unchanged.
+ */
+static void set_rlimit(const char *spec)
+{
+	const char *eq = strchr(spec, '=');
+	if (eq == NULL)
+		errx(EXIT_ERR, "invalid rlimit spec (must be NAME=SOFT[:HARD]): %s", spec);
+
+	const char *name = spec;
+	if (strncasecmp(name, "RLIMIT_", 7) == 0)
+		name += 7;
+	size_t i, len = eq - name;
+	for (i = 0; i < ARRAY_SIZE(rlimits); ++i)
+		if (strlen(rlimits[i].name) == len &&
+		    strncasecmp(rlimits[i].name, name, len) == 0)
+			break;
+	if (i == ARRAY_SIZE(rlimits))
+		errx(EXIT_ERR, "unknown resource limit: %.*s", (int)(eq - spec), spec);
+
+	struct rlimit rlim;
+	if (getrlimit(rlimits[i].value, &rlim))
+		err(EXIT_ERR, "getrlimit(%s) failed", rlimits[i].name);
+
+	char *soft = strdup(eq + 1);
+	if (soft == NULL)
+		err(EXIT_ERR, "strdup() failed");
+	char *hard = strchr(soft, ':');
+	if (hard)
+		*hard++ = '\0';
+	parse_rlim(soft, &rlim.rlim_cur);
+	if (hard)
+		parse_rlim(hard, &rlim.rlim_max);
+	free(soft);
+
+	if (setrlimit(rlimits[i].value, &rlim))
+		err(EXIT_ERR, "could not set resource limit: %s", spec);
+}
+
+/* Adjust the niceness by |arg| like nice(1). */
+static void set_nice(const char *arg)
+{
+	long inc = xatoi(arg, 10);
+	if (inc < INT_MIN || inc > INT_MAX)
+		errx(EXIT_ERR, "invalid nice value: %s", arg);
+	errno = 0;
+	if (nice(inc) == -1 && errno)
+		err(EXIT_ERR, "could not set nice value: %s", arg);
+}
+
+#ifdef __linux__
+/*
+ * List of scheduling policies for --sched.  It's only supported on Linux as
+ * sched_setscheduler is optional in POSIX (e.g. macOS doesn't have it).
+ *
+ * The Linux specific policies are GNU extensions in the C library, so define
+ * what we need.
+ */
+#define NOSIG_SCHED_BATCH 3
+#define NOSIG_SCHED_IDLE 5
+#define NOSIG_SCHED_DEADLINE 6
+#define P(name, policy) { name, policy }
+static const struct pair sched_policies[] = {
+	P("other", SCHED_OTHER),
+	P("fifo", SCHED_FIFO),
+	P("rr", SCHED_RR),
+	P("batch", NOSIG_SCHED_BATCH),
+	P("idle", NOSIG_SCHED_IDLE),
+};
+#undef P
+
+#ifdef SYS_sched_setattr
+/* C libraries don't all provide this (or a wrapper), so use our own. */
+struct nosig_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+/* Use SCHED_DEADLINE with |arg| in the form RUNTIME/PERIOD (in ns). */
+static void set_sched_deadline(const char *arg)
+{
+	struct nosig_sched_attr attr;
+	char *end;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = NOSIG_SCHED_DEADLINE;
+	attr.sched_runtime = strtoull(arg, &end, 10);
+	if (end == arg || *end != '/')
+		errx(EXIT_ERR, "invalid deadline (must be RUNTIME/PERIOD): %s", arg);
+	arg = end + 1;
+	attr.sched_period = strtoull(arg, &end, 10);
+	if (end == arg || *end)
+		errx(EXIT_ERR, "invalid deadline (must be RUNTIME/PERIOD): %s", arg);
+	attr.sched_deadline = attr.sched_period;
+
+	if (linux_syscall(SYS_sched_setattr, 0, (long)&attr, 0))
+		err(EXIT_ERR, "could not set deadline scheduling");
+}
+#endif
+
+/* Set the scheduling policy from |spec| in the form POLICY[:PRIO]. */
+static void set_sched(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	size_t i, len = colon ? (size_t)(colon - spec) : strlen(spec);
+
+#ifdef SYS_sched_setattr
+	if (len == 8 && strncmp(spec, "deadline", len) == 0) {
+		if (colon == NULL)
+			errx(EXIT_ERR, "missing deadline (must be deadline:RUNTIME/PERIOD)");
+		set_sched_deadline(colon + 1);
+		return;
+	}
+#endif
+
+	for (i = 0; i < ARRAY_SIZE(sched_policies); ++i)
+		if (strlen(sched_policies[i].name) == len &&
+		    strncmp(sched_policies[i].name, spec, len) == 0)
+			break;
+	if (i == ARRAY_SIZE(sched_policies))
+		errx(EXIT_ERR, "unknown scheduling policy: %s", spec);
+	int policy = sched_policies[i].value;
+
+	/* Only the realtime policies have (and need) priorities. */
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	bool rt = policy == SCHED_FIFO || policy == SCHED_RR;
+	if (rt != (colon != NULL))
+		errx(EXIT_ERR, "%s priority for policy: %s", rt ? "missing" : "unexpected", spec);
+	if (colon) {
+		long prio = xatoi(colon + 1, 10);
+		if (prio < sched_get_priority_min(policy) ||
+		    prio > sched_get_priority_max(policy))
+			errx(EXIT_ERR, "invalid priority for policy: %s", spec);
+		param.sched_priority = prio;
+	}
+
+	if (sched_setscheduler(0, policy, &param))
+		err(EXIT_ERR, "could not set scheduling policy: %s", spec);
+}
+
+/*
+ * Read a small sysfs file (relative to /sys) with the trailing newline removed.
+ * Returns NULL if it doesn't exist.  Tests may point $NOSIG_SYSFS_ROOT at a
+ * fake tree instead (see ENVIRONMENT in the man page).
+ */
+static char *read_sysfs(const char *fmt, ...)
+{
+	static const char *root;
+	char path[PATH_MAX];
+	va_list args;
+
+	if (root == NULL) {
+		root = getenv("NOSIG_SYSFS_ROOT");
+		if (root == NULL)
+			root = "/sys";
+	}
+
+	int len = snprintf(path, sizeof(path), "%s/", root);
+	va_start(args, fmt);
+	vsnprintf(&path[len], sizeof(path) - len, fmt, args);
+	va_end(args);
+
+	FILE *fp = fopen(path, "re");
+	if (fp == NULL)
+		return NULL;
+	char *line = NULL;
+	size_t n = 0;
+	ssize_t ret = getline(&line, &n, fp);
+	fclose(fp);
+	if (ret < 0) {
+		free(line);
+		return NULL;
+	}
+	if (ret && line[ret - 1] == '\n')
+		line[ret - 1] = '\0';
+	return line;
+}
+
+/* cpu_set_t & its helpers are GNU extensions, so define what we need. */
+#define MAX_CPUS 1024
+#define CPUMASK_BITS (sizeof(unsigned long) * CHAR_BIT)
+typedef struct {
+	unsigned long bits[MAX_CPUS / CPUMASK_BITS];
+} cpumask_t;
+#define CPUMASK_ZERO(mask) memset((mask), 0, sizeof(cpumask_t))
+#define CPUMASK_SET(cpu, mask) ((mask)->bits[(cpu) / CPUMASK_BITS] |= 1UL << ((cpu) % CPUMASK_BITS))
+#define CPUMASK_ISSET(cpu, mask) \
+	(!!((mask)->bits[(cpu) / CPUMASK_BITS] & (1UL << ((cpu) % CPUMASK_BITS))))
+#define CPUMASK_EQUAL(a, b) (memcmp((a), (b), sizeof(cpumask_t)) == 0)
+
+static int cpumask_count(const cpumask_t *mask)
+{
+	int cpu, cnt = 0;
+	for (cpu = 0; cpu < MAX_CPUS; ++cpu)
+		cnt += CPUMASK_ISSET(cpu, mask);
+	return cnt;
+}
+
+static void cpumask_or(cpumask_t *dst, const cpumask_t *src)
+{
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(dst->bits); ++i)
+		dst->bits[i] |= src->bits[i];
+}
+
+static void parse_cpus(const char *list, cpumask_t *set);
+
+/* Like read_sysfs, but for files holding a list of CPUs. */
+static bool read_sysfs_cpus(cpumask_t *set, const char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(path, sizeof(path), fmt, args);
+	va_end(args);
+
+	char *list = read_sysfs("%s", path);
+	if (list == NULL)
+		return false;
+	CPUMASK_ZERO(set);
+	parse_cpus(list, set);
+	free(list);
+	return true;
+}
+
+/* The CPU topology for --cpus selectors.  Loaded once on demand. */
+static struct {
+	bool loaded;
+	cpumask_t online;
+	/* Index of the CPU among its hyperthread siblings. */
+	int thread[MAX_CPUS];
+	/* The last level cache domain each CPU belongs to. */
+	int llc[MAX_CPUS];
+	cpumask_t *llcs;
+	size_t llc_cnt;
+} topo;
+
+static void load_topology(void)
+{
+	cpumask_t set;
+	int cpu, i;
+
+	if (topo.loaded)
+		return;
+	topo.loaded = true;
+
+	if (!read_sysfs_cpus(&topo.online, "devices/system/cpu/online"))
+		errx(EXIT_ERR, "could not read CPU topology from sysfs");
+
+	for (cpu = 0; cpu < MAX_CPUS; ++cpu) {
+		if (!CPUMASK_ISSET(cpu, &topo.online))
+			continue;
+
+		topo.thread[cpu] = 0;
+		if (read_sysfs_cpus(&set, "devices/system/cpu/cpu%i/topology/thread_siblings_list", cpu))
+			for (i = 0; i < cpu; ++i)
+				topo.thread[cpu] += !!CPUMASK_ISSET(i, &set);
+
+		/* Find the highest level data (or unified) cache. */
+		int idx, level, max_level = 0;
+		CPUMASK_ZERO(&set);
+		CPUMASK_SET(cpu, &set);
+		for (idx = 0; ; ++idx) {
+			char *str = read_sysfs("devices/system/cpu/cpu%i/cache/index%i/level", cpu, idx);
+			if (str == NULL)
+				break;
+			level = atoi(str);
+			free(str);
+			str = read_sysfs("devices/system/cpu/cpu%i/cache/index%i/type", cpu, idx);
+			bool icache = str && strcmp(str, "Instruction") == 0;
+			free(str);
+			if (icache || level <= max_level)
+				continue;
+			if (read_sysfs_cpus(&set, "devices/system/cpu/cpu%i/cache/index%i/shared_cpu_list", cpu, idx))
+				max_level = level;
+		}
+
+		/* Domains are numbered by their lowest CPU. */
+		size_t d;
+		for (d = 0; d < topo.llc_cnt; ++d)
+			if (CPUMASK_EQUAL(&set, &topo.llcs[d]))
+				break;
+		if (d == topo.llc_cnt) {
+			cpumask_t *new_llcs = realloc(topo.llcs, sizeof(*topo.llcs) * (d + 1));
+			if (new_llcs == NULL)
+				err(EXIT_ERR, "realloc() failed");
+			topo.llcs = new_llcs;
+			topo.llcs[topo.llc_cnt++] = set;
+		}
+		topo.llc[cpu] = d;
+	}
+}
+
+/*
+ * Pick |cnt| CPUs spread out as much as possible: round-robin across the last
+ * level caches, and only use a hyperthread sibling once every core has one.
+ */
+static void spread_cpus(long cnt, cpumask_t *set)
+{
+	int cpu, rank;
+	size_t d;
+
+	if (cnt > cpumask_count(&topo.online))
+		errx(EXIT_ERR, "only %i cpus available to spread across", cpumask_count(&topo.online));
+
+	int *next = malloc(sizeof(*next) * topo.llc_cnt);
+	if (next == NULL)
+		err(EXIT_ERR, "malloc() failed");
+
+	for (rank = 0; cnt; ++rank) {
+		bool progress = true;
+		memset(next, 0, sizeof(*next) * topo.llc_cnt);
+		while (cnt && progress) {
+			progress = false;
+			for (d = 0; d < topo.llc_cnt && cnt; ++d) {
+				for (cpu = next[d]; cpu < MAX_CPUS; ++cpu)
+					if (CPUMASK_ISSET(cpu, &topo.online) && topo.llc[cpu] == (int)d &&
+					    topo.thread[cpu] == rank)
+						break;
+				next[d] = cpu + 1;
+				if (cpu < MAX_CPUS) {
+					CPUMASK_SET(cpu, set);
+					--cnt;
+					progress = true;
+				}
+			}
+		}
+	}
+
+	free(next);
+}
+
+/*
+ * Add the CPUs for a topology |selector| to |set|:
+ *   node:N              The CPUs in NUMA node N.
+ *   llc:N               The CPUs sharing the Nth last level cache.
+ *   core-siblings-of:N  The CPUs in the same physical package as CPU N.
+ *   thread-siblings-of:N  The hyperthreads of the same core as CPU N.
+ *   spread:N            N CPUs spread across caches & cores.
+ */
+static void select_cpus(const char *selector, cpumask_t *set)
+{
+	const char *colon = strchr(selector, ':');
+	size_t len = colon - selector;
+	long n = xatoi(colon + 1, 10);
+	cpumask_t sel;
+
+	if (colon[1] == '\0' || n < 0 || n >= MAX_CPUS)
+		errx(EXIT_ERR, "invalid cpu selector: %s", selector);
+
+#define IS(name) (len == sizeof(name) - 1 && strncmp(selector, name, len) == 0)
+	if (IS("node")) {
+		if (!read_sysfs_cpus(&sel, "devices/system/node/node%li/cpulist", n))
+			errx(EXIT_ERR, "unknown NUMA node: %s", selector);
+		cpumask_or(set, &sel);
+		return;
+	}
+
+	load_topology();
+	if (IS("llc")) {
+		if ((size_t)n >= topo.llc_cnt)
+			errx(EXIT_ERR, "unknown cache (only %zu): %s", topo.llc_cnt, selector);
+		cpumask_or(set, &topo.llcs[n]);
+	} else if (IS("core-siblings-of") || IS("thread-siblings-of")) {
+		if (!CPUMASK_ISSET(n, &topo.online) ||
+		    !read_sysfs_cpus(&sel, "devices/system/cpu/cpu%li/topology/%s_siblings_list",
+		                     n, selector[0] == 'c' ? "core" : "thread"))
+			errx(EXIT_ERR, "unknown cpu: %s", selector);
+		cpumask_or(set, &sel);
+	} else if (IS("spread")) {
+		if (n == 0)
+			errx(EXIT_ERR, "invalid cpu selector: %s", selector);
+		spread_cpus(n, set);
+	} else
+		errx(EXIT_ERR, "unknown cpu selector: %s", selector);
+#undef IS
+}
+
+/* Add a list of CPUs (and topology selectors) like "0,2,4-7,llc:1" to |set|. */
+static void parse_cpus(const char *list, cpumask_t *set)
+{
+	char *copy = strdup(list), *tok, *saveptr;
+	if (copy == NULL)
+		err(EXIT_ERR, "strdup() failed");
+
+	for (tok = strtok_r(copy, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (strchr(tok, ':')) {
+			select_cpus(tok, set);
+			continue;
+		}
+
+		long first, last;
+		parse_range(tok, &first, &last);
+		if (first < 0 || last < first || last >= MAX_CPUS)
+			errx(EXIT_ERR, "invalid cpu range: %s", list);
+		for (; first <= last; ++first)
+			CPUMASK_SET(first, set);
+	}
+
+	free(copy);
+}
+
+/* Format |set| as a compact list like "0,2,4-7". */
+static void format_cpus(const cpumask_t *set, char *buf, size_t len)
+{
+	int cpu, first;
+	size_t pos = 0;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu < MAX_CPUS; ++cpu) {
+		if (!CPUMASK_ISSET(cpu, set))
+			continue;
+		for (first = cpu; cpu + 1 < MAX_CPUS && CPUMASK_ISSET(cpu + 1, set); ++cpu)
+			continue;
+		int ret = first == cpu ?
+			snprintf(&buf[pos], len - pos, "%s%i", pos ? "," : "", cpu) :
+			snprintf(&buf[pos], len - pos, "%s%i-%i", pos ? "," : "", first, cpu);
+		if (ret < 0 || (size_t)ret >= len - pos)
+			break;
+		pos += ret;
+	}
+}
+
+/* Restrict the CPUs we (and the program) may run on like taskset(1). */
+static void set_cpus(const char *list)
+{
+	cpumask_t set;
+	CPUMASK_ZERO(&set);
+	parse_cpus(list, &set);
+	if (cpumask_count(&set) == 0)
+		errx(EXIT_ERR, "no cpus selected: %s", list);
+	if (verbose) {
+		char buf[1024];
+		format_cpus(&set, buf, sizeof(buf));
+		warnx("using cpus: %s", buf);
+	}
+	if (linux_syscall(SYS_sched_setaffinity, 0, sizeof(set), (long)&set))
+		err(EXIT_ERR, "could not set cpu affinity: %s", list);
+}
+#endif
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+/* The numaif.h header isn't always available, so define what we need. */
+# define NOSIG_MPOL_PREFERRED 1
+# define NOSIG_MPOL_BIND 2
+# define NOSIG_MPOL_INTERLEAVE 3
+# define MAX_NODES 1024
+typedef unsigned long nodemask_t[MAX_NODES / (sizeof(unsigned long) * CHAR_BIT)];
+# define NODE_BITS (sizeof(unsigned long) * CHAR_BIT)
+# define NODE_SET(node, mask) ((mask)[(node) / NODE_BITS] |= 1UL << ((node) % NODE_BITS))
+# define NODE_ISSET(node, mask) (!!((mask)[(node) / NODE_BITS] & (1UL << ((node) % NODE_BITS))))
+
+/* Parse a list of NUMA nodes like "0,2-3" (or "all") into |mask|. */
+static void parse_nodes(const char *list, nodemask_t mask)
+{
+	nodemask_t online;
+	long node;
+
+	memset(mask, 0, sizeof(nodemask_t));
+	memset(online, 0, sizeof(online));
+
+	char *str = read_sysfs("devices/system/node/online");
+	if (str == NULL)
+		errx(EXIT_ERR, "could not read NUMA nodes from sysfs");
+	char *copy = strcmp(list, "all") ? strdup(list) : strdup(str), *tok, *saveptr;
+	if (copy == NULL)
+		err(EXIT_ERR, "strdup() failed");
+
+	for (tok = strtok_r(str, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		long first, last;
+		parse_range(tok, &first, &last);
+		for (node = first; node >= 0 && node <= last && node < MAX_NODES; ++node)
+			NODE_SET(node, online);
+	}
+
+	for (tok = strtok_r(copy, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		long first, last;
+		parse_range(tok, &first, &last);
+		if (first < 0 || last < first || last >= MAX_NODES)
+			errx(EXIT_ERR, "invalid node range: %s", list);
+		for (node = first; node <= last; ++node) {
+			if (!NODE_ISSET(node, online))
+				errx(EXIT_ERR, "unknown NUMA node %li: %s", node, list);
+			NODE_SET(node, mask);
+		}
+	}
+
+	free(copy);
+	free(str);
+}
+
+/* Set the NUMA memory policy like numactl(8). */
+static void set_mempolicy_nodes(int mode, const char *list)
+{
+	nodemask_t mask;
+	parse_nodes(list, mask);
+
+	if (mode == NOSIG_MPOL_PREFERRED) {
+		int node, cnt = 0;
+		for (node = 0; node < MAX_NODES; ++node)
+			cnt += NODE_ISSET(node, mask);
+		if (cnt != 1)
+			errx(EXIT_ERR, "only one preferred node may be used: %s", list);
+	}
+
+	/* The kernel has an off-by-one with the node count, so add one. */
+	if (linux_syscall(SYS_set_mempolicy, mode, (long)mask, MAX_NODES + 1))
+		err(EXIT_ERR, "could not set memory policy: %s", list);
+}
+#endif
+
+#ifdef __linux__
+# ifdef PR_SET_THP_DISABLE
+/* Disable transparent huge pages (which can cause latency spikes). */
+static void disable_thp(void)
+{
+	if (prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0))
+		err(EXIT_ERR, "could not disable transparent huge pages");
+}
+# endif
+
+# ifdef PR_SET_TIMERSLACK
+/* Set how late (in ns) the kernel may fire timers to batch up wakeups. */
+static void set_timer_slack(const char *arg)
+{
+	long slack = xatoi(arg, 10);
+	if (slack < 0)
+		errx(EXIT_ERR, "invalid timer slack: %s", arg);
+	if (prctl(PR_SET_TIMERSLACK, (unsigned long)slack, 0, 0, 0))
+		err(EXIT_ERR, "could not set timer slack: %s", arg);
+}
+# endif
+
+# ifdef SYS_ioprio_set
+/* The C library doesn't provide these, so define what we need. */
+#  define NOSIG_IOPRIO_WHO_PROCESS 1
+#  define NOSIG_IOPRIO_CLASS_SHIFT 13
+#  define NOSIG_IOPRIO_CLASS_RT 1
+#  define NOSIG_IOPRIO_CLASS_BE 2
+#  define NOSIG_IOPRIO_CLASS_IDLE 3
+
+/* List of I/O scheduling classes for --ioprio. */
+#  define P(name, class) { name, class }
+static const struct pair ioprio_classes[] = {
+	P("realtime", NOSIG_IOPRIO_CLASS_RT),
+	P("rt", NOSIG_IOPRIO_CLASS_RT),
+	P("best-effort", NOSIG_IOPRIO_CLASS_BE),
+	P("be", NOSIG_IOPRIO_CLASS_BE),
+	P("idle", NOSIG_IOPRIO_CLASS_IDLE),
+};
+#  undef P
+
+/* Set the I/O priority from |spec| in the form CLASS[:LEVEL] like ionice(1). */
+static void set_ioprio(const char *spec)
+{
+	const char *colon = strchr(spec, ':');
+	size_t i, len = colon ? (size_t)(colon - spec) : strlen(spec);
+	long level = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ioprio_classes); ++i)
+		if (strlen(ioprio_classes[i].name) == len &&
+		    strncmp(ioprio_classes[i].name, spec, len) == 0)
+			break;
+	if (i == ARRAY_SIZE(ioprio_classes))
+		errx(EXIT_ERR, "unknown I/O class: %s", spec);
+	int class = ioprio_classes[i].value;
+
+	/* The idle class doesn't have levels. */
+	if (colon) {
+		level = xatoi(colon + 1, 10);
+		if (class == NOSIG_IOPRIO_CLASS_IDLE || level < 0 || level > 7)
+			errx(EXIT_ERR, "invalid I/O priority level: %s", spec);
+	} else if (class != NOSIG_IOPRIO_CLASS_IDLE)
+		level = 4;
+
+	if (linux_syscall(SYS_ioprio_set, NOSIG_IOPRIO_WHO_PROCESS, 0,
+	                  (class << NOSIG_IOPRIO_CLASS_SHIFT) | level))
+		err(EXIT_ERR, "could not set I/O priority: %s", spec);
+}
+# endif
+
+/* Adjust how likely the OOM killer is to pick us (-1000 to 1000). */
+static void set_oom_score_adj(const char *arg)
+{
+	long adj = xatoi(arg, 10);
+	if (adj < -1000 || adj > 1000)
+		errx(EXIT_ERR, "invalid OOM score adjustment: %s", arg);
+
+	int fd = open("/proc/self/oom_score_adj", O_WRONLY|O_CLOEXEC);
+	if (fd < 0)
+		err(EXIT_ERR, "could not open /proc/self/oom_score_adj");
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%li\n", adj);
+	if (write(fd, buf, len) != len)
+		err(EXIT_ERR, "could not set OOM score adjustment: %s", arg);
+	close(fd);
+}
+#endif
+
+/* Whether to --warm the program before running it. */
+static bool warm = false;
+#ifdef __linux__
+/*
+ * Support for --warm: pull the program & its shared libraries into the page
+ * cache before running it.  We only parse ELF files of our own class since
+ * that's what the system normally runs; others just get the file itself warmed.
+ */
+# if UINTPTR_MAX > 0xffffffff
+#  define ElfW(type) Elf64_##type
+#  define NOSIG_ELFCLASS ELFCLASS64
+# else
+#  define ElfW(type) Elf32_##type
+#  define NOSIG_ELFCLASS ELFCLASS32
+# endif
+
+/* Files we've already warmed, to avoid loops & redundant I/O. */
+static char **warmed = NULL;
+static size_t warmed_cnt = 0;
+
+static bool warm_elf(const char *path, bool lib);
+
+/* Look up a DT_NEEDED |lib| in the |search| dirs, and warm it if found. */
+static void warm_lib(const char *lib, const char *search, const char *origin)
+{
+	/* Libs with paths are used as-is. */
+	if (strchr(lib, '/')) {
+		warm_elf(lib, true);
+		return;
+	}
+
+	char *dirs = strdup(search), *dir, *saveptr;
+	if (dirs == NULL)
+		err(EXIT_ERR, "strdup() failed");
+	for (dir = strtok_r(dirs, ":", &saveptr); dir;
+	     dir = strtok_r(NULL, ":", &saveptr)) {
+		char path[PATH_MAX];
+		if (strncmp(dir, "$ORIGIN", 7) == 0)
+			snprintf(path, sizeof(path), "%s%s/%s", origin, &dir[7], lib);
+		else
+			snprintf(path, sizeof(path), "%s/%s", dir, lib);
+		if (warm_elf(path, true))
+			break;
+	}
+	free(dirs);
+}
+
+/* Translate a virtual address in the ELF into a file offset. */
+static const void *elf_vaddr(const char *map, size_t len, const ElfW(Phdr) *phdrs,
+                             size_t phnum, uint64_t vaddr)
+{
+	size_t i;
+	for (i = 0; i < phnum; ++i) {
+		const ElfW(Phdr) *phdr = &phdrs[i];
+		if (phdr->p_type == PT_LOAD && vaddr >= phdr->p_vaddr &&
+		    vaddr < phdr->p_vaddr + phdr->p_filesz) {
+			uint64_t off = phdr->p_offset + (vaddr - phdr->p_vaddr);
+			return off < len ? &map[off] : NULL;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Warm |path|, and if it's an ELF, its interpreter & libraries too.  For |lib|s,
+ * returns false if it isn't usable so the next search dir should be tried.
+ */
+static bool warm_elf(const char *path, bool lib)
+{
+	size_t i;
+
+	for (i = 0; i < warmed_cnt; ++i)
+		if (streq(warmed[i], path))
+			return true;
+
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	size_t len = st.st_size;
+
+	/* Only parse ELFs we understand.  Others (e.g. scripts) just get warmed. */
+	const ElfW(Ehdr) *ehdr = (const void *)map;
+	bool is_elf = len >= sizeof(*ehdr) && memcmp(ehdr->e_ident, ELFMAG, SELFMAG) == 0;
+	bool native = is_elf && ehdr->e_ident[EI_CLASS] == NOSIG_ELFCLASS &&
+		ehdr->e_phentsize == sizeof(ElfW(Phdr)) && ehdr->e_phoff < len &&
+		ehdr->e_phnum <= (len - ehdr->e_phoff) / sizeof(ElfW(Phdr));
+
+	/* Skip libs for other ABIs (e.g. 32-bit libs in a 64-bit search dir). */
+	if (lib && !native) {
+		munmap((void *)map, len);
+		close(fd);
+		return false;
+	}
+
+	char **new_warmed = realloc(warmed, sizeof(*warmed) * (warmed_cnt + 1));
+	if (new_warmed == NULL || (new_warmed[warmed_cnt] = strdup(path)) == NULL)
+		err(EXIT_ERR, "memory allocation failed");
+	warmed = new_warmed;
+	++warmed_cnt;
+
+	/* This kicks off the reads in the background for us. */
+	if (verbose)
+		warnx("warming %s", path);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+
+	if (!native) {
+		munmap((void *)map, len);
+		return true;
+	}
+
+	const ElfW(Phdr) *phdrs = (const void *)&map[ehdr->e_phoff];
+	size_t phnum = ehdr->e_phnum;
+	const ElfW(Dyn) *dyn = NULL, *dyn_end = NULL;
+	for (i = 0; i < phnum; ++i) {
+		const ElfW(Phdr) *phdr = &phdrs[i];
+		if (phdr->p_offset >= len || phdr->p_filesz > len - phdr->p_offset)
+			continue;
+		if (phdr->p_type == PT_INTERP) {
+			char interp[PATH_MAX];
+			snprintf(interp, sizeof(interp), "%.*s", (int)phdr->p_filesz,
+			         &map[phdr->p_offset]);
+			warm_elf(interp, false);
+		} else if (phdr->p_type == PT_DYNAMIC) {
+			dyn = (const void *)&map[phdr->p_offset];
+			dyn_end = dyn + phdr->p_filesz / sizeof(*dyn);
+		}
+	}
+
+	/* Find the string table & search paths first, then the libs. */
+	const char *strtab = NULL;
+	uint64_t strsz = 0, runpath = UINT64_MAX;
+	const ElfW(Dyn) *d;
+	for (d = dyn; d && d < dyn_end && d->d_tag != DT_NULL; ++d) {
+		if (d->d_tag == DT_STRTAB)
+			strtab = elf_vaddr(map, len, phdrs, phnum, d->d_un.d_ptr);
+		else if (d->d_tag == DT_STRSZ)
+			strsz = d->d_un.d_val;
+		else if (d->d_tag == DT_RUNPATH || (d->d_tag == DT_RPATH && runpath == UINT64_MAX))
+			runpath = d->d_un.d_val;
+	}
+	if (strtab == NULL || strsz > (uint64_t)(&map[len] - strtab)) {
+		munmap((void *)map, len);
+		return true;
+	}
+
+	/* Approximate the ldso search order; ld.so.cache is too much to parse. */
+	char origin[PATH_MAX], search[PATH_MAX * 2];
+	snprintf(origin, sizeof(origin), "%s", path);
+	char *slash = strrchr(origin, '/');
+	if (slash)
+		*slash = '\0';
+	else
+		strcpy(origin, ".");
+	const char *ld_path = env_get("LD_LIBRARY_PATH");
+	snprintf(search, sizeof(search), "%s:%s:%s",
+	         runpath < strsz ? &strtab[runpath] : "",
+	         ld_path ? ld_path : "",
+	         "/lib64:/usr/lib64:/lib:/usr/lib"
+# ifdef __x86_64__
+	         ":/lib/x86_64-linux-gnu:/usr/lib/x86_64-linux-gnu"
+# elif defined(__aarch64__)
+	         ":/lib/aarch64-linux-gnu:/usr/lib/aarch64-linux-gnu"
+# endif
+	         );
+
+	for (d = dyn; d && d < dyn_end && d->d_tag != DT_NULL; ++d)
+		if (d->d_tag == DT_NEEDED && d->d_un.d_val < strsz)
+			warm_lib(&strtab[d->d_un.d_val], search, origin);
+
+	munmap((void *)map, len);
+	return true;
+}
+
+/* Warm the program (as exec_prog will find it) before we run it. */
+static void warm_prog(const char *prog)
+{
+	char fdpath[32];
+	const char *path;
+
+	if (exec_fd >= 0) {
+		snprintf(fdpath, sizeof(fdpath), "/proc/self/fd/%i", exec_fd);
+		path = fdpath;
+	} else
+		path = resolve_prog(prog);
+	if (path)
+		warm_elf(path, false);
+}
+#endif
+
+/* Sockets for --listen that get passed to the program. */
+static int *listen_fds = NULL;
+static size_t listen_cnt = 0;
+
+/* Destinations for --tee. */
+static int *tee_fds = NULL;
+static size_t tee_cnt = 0;
+
+/* List of fds (as [first,last] ranges) for --close-fds to leave alone. */
+struct fd_range {
+	int first, last;
+};
+static struct fd_range *keep_fds = NULL;
+static size_t keep_fds_cnt = 0;
+
+static void keep_fd_range(int first, int last)
+{
+	struct fd_range *new_keep = realloc(keep_fds, sizeof(*keep_fds) * (keep_fds_cnt + 1));
+	if (new_keep == NULL)
+		err(EXIT_ERR, "realloc() failed");
+	keep_fds = new_keep;
+	keep_fds[keep_fds_cnt].first = first;
+	keep_fds[keep_fds_cnt].last = last;
+	++keep_fds_cnt;
+}
+
+/* Parse a list of fds like "3,5,7-9" to keep open. */
+static void parse_keep_fds(const char *list)
+{
+	char *copy = strdup(list), *tok, *saveptr;
+	if (copy == NULL)
+		err(EXIT_ERR, "strdup() failed");
+
+	for (tok = strtok_r(copy, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		long first, last;
+		parse_range(tok, &first, &last);
+		if (first < 0 || last < first || last > INT_MAX)
+			errx(EXIT_ERR, "invalid fd range: %s", list);
+		keep_fd_range(first, last);
+	}
+
+	free(copy);
+}
+
+static bool keep_fd(int fd)
+{
+	size_t i;
+	if (fd < 3 || fd == exec_fd || fd == cgroup_fd)
+		return true;
+	for (i = 0; i < listen_cnt; ++i)
+		if (fd == listen_fds[i])
+			return true;
+	for (i = 0; i < tee_cnt; ++i)
+		if (fd == tee_fds[i])
+			return true;
+	for (i = 0; i < keep_fds_cnt; ++i)
+		if (fd >= keep_fds[i].first && fd <= keep_fds[i].last)
+			return true;
+	return false;
+}
+
+/* Close all fds in [first,last].  Returns false if the OS doesn't support it. */
+static bool close_fd_range(unsigned int first, unsigned int last)
+{
+#if defined(__linux__) && defined(SYS_close_range)
+	if (linux_syscall(SYS_close_range, first, last, 0) == 0)
+		return true;
+#else
+	(void)first;
+	(void)last;
+#endif
+	return false;
+}
+
+/* qsort helper for fd ranges. */
+static int cmp_fd(const void *a, const void *b)
+{
+	return ((const struct fd_range *)a)->first - ((const struct fd_range *)b)->first;
+}
+
+/*
+ * Close all open fds beyond stdin/stdout/stderr except ones the user asked us
+ * to keep.  Programs inheriting a lot of fds from their parent can waste a lot
+ * of resources (memory & slower poll/fork/etc...).
+ */
+static void close_fds(void)
+{
+	size_t i;
+	int fd;
+
+	/*
+	 * Try the fast route first: close everything between the kept fds in as few
+	 * syscalls as possible.  If any fail, fallback to doing it ourselves.
+	 */
+	struct fd_range *ranges = malloc(sizeof(*ranges) * (keep_fds_cnt + listen_cnt + tee_cnt + 2));
+	if (ranges == NULL)
+		err(EXIT_ERR, "malloc() failed");
+	memcpy(ranges, keep_fds, sizeof(*ranges) * keep_fds_cnt);
+	size_t ranges_cnt = keep_fds_cnt;
+	if (exec_fd >= 0)
+		ranges[ranges_cnt++] = (struct fd_range){ exec_fd, exec_fd };
+	if (cgroup_fd >= 0)
+		ranges[ranges_cnt++] = (struct fd_range){ cgroup_fd, cgroup_fd };
+	for (i = 0; i < listen_cnt; ++i)
+		ranges[ranges_cnt++] = (struct fd_range){ listen_fds[i], listen_fds[i] };
+	for (i = 0; i < tee_cnt; ++i)
+		ranges[ranges_cnt++] = (struct fd_range){ tee_fds[i], tee_fds[i] };
+	/* Sort the ranges by their first fd so we can walk the gaps. */
+	qsort(ranges, ranges_cnt, sizeof(*ranges), cmp_fd);
+
+	unsigned int next = 3;
+	bool ok = true;
+	for (i = 0; ok && i < ranges_cnt; ++i) {
+		if (ranges[i].last < 3)
+			continue;
+		if ((unsigned int)ranges[i].first > next)
+			ok = close_fd_range(next, ranges[i].first - 1);
+		if ((unsigned int)ranges[i].last >= next)
+			next = (unsigned int)ranges[i].last + 1;
+	}
+	if (ok)
+		ok = close_fd_range(next, ~0U);
+	free(ranges);
+	if (ok)
+		return;
+
+	/* Walk the list of open fds if the OS gives us one. */
+#ifdef __linux__
+	DIR *dir = opendir("/proc/self/fd");
+#else
+	DIR *dir = opendir("/dev/fd");
+#endif
+	if (dir) {
+		int *fds = NULL;
+		size_t cnt = 0, alloc = 0;
+		struct dirent *de;
+
+		/* Can't close while reading the dir as it has its own open fd. */
+		while ((de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			fd = xatoi(de->d_name, 10);
+			if (fd == dirfd(dir) || keep_fd(fd))
+				continue;
+			if (cnt == alloc) {
+				alloc = alloc ? alloc * 2 : 64;
+				int *new_fds = realloc(fds, sizeof(*fds) * alloc);
+				if (new_fds == NULL)
+					err(EXIT_ERR, "realloc() failed");
+				fds = new_fds;
+			}
+			fds[cnt++] = fd;
+		}
+		closedir(dir);
+
+		for (i = 0; i < cnt; ++i)
+			close(fds[i]);
+		free(fds);
+		return;
+	}
+
+	/* Last resort: brute force all possible fds. */
+	long max = sysconf(_SC_OPEN_MAX);
+	if (max < 0 || max > INT_MAX)
+		max = INT_MAX;
+	for (fd = 3; fd < max; ++fd)
+		if (!keep_fd(fd))
+			close(fd);
+}
+
+/*
+ * Output sinks.
+ *
+ * These are small helper processes that sit between the program's output and
+ * its final destination.  They're forked off (and orphaned) before we exec, so
+ * the program still keeps our pid & exit status, and they exit on their own
+ * once the program (and anything it spawned) closes its end of the pipe.
+ */
+typedef void (*sink_fn)(int rfd, void *data);
+
+/* Get the sink process into a known state before running it. */
+static void sink_init(void)
+{
+	struct sigaction sa;
+	sigset_t set;
+
+	/*
+	 * Keep draining the pipe until the program is done with it even if the
+	 * terminal or session goes away.  We'll still die if the output does.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	static const int ignored[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(ignored); ++i)
+		sigaction(ignored[i], &sa, NULL);
+	sa.sa_handler = SIG_DFL;
+	sigaction(SIGPIPE, &sa, NULL);
+	sigemptyset(&set);
+	sigprocmask(SIG_SETMASK, &set, NULL);
+
+	/* Don't steal input from the program. */
+	redirect_input_from("/dev/null");
+}
+
+/*
+ * Start a sink process running |fn| and redirect |fd1| (and |fd2| if it's not
+ * -1) to it.  The sink inherits the original fds before they're redirected.
+ */
+static void start_sink(int fd1, int fd2, sink_fn fn, void *data)
+{
+	int pipefd[2];
+	if (pipe(pipefd))
+		err(EXIT_ERR, "pipe() failed");
+
+	/* Fork twice so the sink isn't a child of the program we run. */
+	struct sigaction old;
+	sigchld_default(&old);
+	pid_t pid = fork();
+	if (pid < 0)
+		err(EXIT_ERR, "fork() failed");
+	if (pid == 0) {
+		sigchld_restore(&old);
+		close(pipefd[1]);
+		pid = fork();
+		if (pid < 0)
+			err(EXIT_ERR, "fork() failed");
+		if (pid)
+			_exit(EXIT_OK);
+		sink_init();
+		fn(pipefd[0], data);
+		_exit(EXIT_OK);
+	}
+	close(pipefd[0]);
+
+	int status = wait_child(pid);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_OK)
+		errx(EXIT_ERR, "could not start output sink");
+	sigchld_restore(&old);
+
+	if (pipefd[1] != fd1 && dup2(pipefd[1], fd1) == -1)
+		err(EXIT_ERR, "could not dup to %i", fd1);
+	if (fd2 >= 0 && pipefd[1] != fd2 && dup2(pipefd[1], fd2) == -1)
+		err(EXIT_ERR, "could not dup to %i", fd2);
+	if (pipefd[1] != fd1 && pipefd[1] != fd2)
+		close(pipefd[1]);
+}
+
+/* Write all of |buf| to |fd|.  Returns false on failure. */
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+/*
+ * Move up to |len| bytes from the pipe |rfd| to |wfd|.  If |off| is not NULL,
+ * write at (and update) that offset rather than the current file position.
+ * Returns the number of bytes moved, 0 at EOF, or -1 on error.
+ *
+ * On Linux we use splice to avoid copying the data through userspace.  That
+ * doesn't work with all outputs (e.g. O_APPEND files), so fallback to a
+ * plain read & write when it fails.
+ */
+static ssize_t sink_move(int rfd, int wfd, off_t *off, size_t len)
+{
+	ssize_t ret;
+
+#ifdef __linux__
+	do {
+		ret = linux_splice(rfd, wfd, off, len);
+	} while (ret < 0 && errno == EINTR);
+	if (ret >= 0 || errno != EINVAL)
+		return ret;
+#endif
+
+	char buf[64 * 1024];
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+	do {
+		ret = read(rfd, buf, len);
+	} while (ret < 0 && errno == EINTR);
+	if (ret > 0) {
+		if (off) {
+			if (pwrite(wfd, buf, ret, *off) != ret)
+				return -1;
+			*off += ret;
+		} else if (!write_all(wfd, buf, ret))
+			return -1;
+	}
+	return ret;
+}
+
+/* Return the current time in seconds from an arbitrary start point. */
+static double monotonic_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Settings for --log-to. */
+static struct log_config {
+	int dirfd;
+	int fd;
+	size_t max_size;
+	unsigned long max_age;
+	unsigned long keep;
+} log_config = {
+	.dirfd = -1,
+	.fd = -1,
+	.max_size = 0,
+	.max_age = 0,
+	.keep = 5,
+};
+
+/* The name of the active log file, and the rotated ones. */
+#define LOG_NAME "log"
+
+/* (Re)open the active log file & return its current size. */
+static off_t log_open(struct log_config *log)
+{
+	/* NB: No O_APPEND as splice doesn't allow it.  We're the only writer. */
+	log->fd = openat(log->dirfd, LOG_NAME, O_WRONLY|O_CREAT|O_CLOEXEC, 0666);
+	if (log->fd < 0)
+		return -1;
+	return lseek(log->fd, 0, SEEK_END);
+}
+
+/* Rotate log -> log.1 -> log.2 ... and drop the oldest beyond |keep|. */
+static void log_rotate(struct log_config *log)
+{
+	char old_name[sizeof(LOG_NAME) + 24], new_name[sizeof(LOG_NAME) + 24];
+	unsigned long i;
+
+	close(log->fd);
+
+	if (log->keep == 0) {
+		if (unlinkat(log->dirfd, LOG_NAME, 0))
+			warn("could not remove old log");
+	} else {
+		for (i = log->keep - 1; i > 0; --i) {
+			snprintf(old_name, sizeof(old_name), LOG_NAME ".%lu", i);
+			snprintf(new_name, sizeof(new_name), LOG_NAME ".%lu", i + 1);
+			if (renameat(log->dirfd, old_name, log->dirfd, new_name) && errno != ENOENT)
+				warn("could not rotate %s", old_name);
+		}
+		if (renameat(log->dirfd, LOG_NAME, log->dirfd, LOG_NAME ".1"))
+			warn("could not rotate " LOG_NAME);
+	}
+
+	if (log_open(log) < 0)
+		err(EXIT_ERR, "could not reopen log");
+}
+
+/* The sink process for --log-to. */
+static void log_sink(int rfd, void *data)
+{
+	struct log_config *log = data;
+	off_t size = lseek(log->fd, 0, SEEK_END);
+	double opened = monotonic_time();
+
+	/* We don't need the original stdout, so don't hold it open. */
+	redirect_output_to(1, "/dev/null");
+
+	while (true) {
+		/* Only wait as long as the current log is allowed to live. */
+		if (log->max_age && size) {
+			double left = opened + log->max_age - monotonic_time();
+			struct pollfd pfd = { .fd = rfd, .events = POLLIN };
+			int ret = left <= 0 ? 0 : poll(&pfd, 1, left * 1000 + 1);
+			if (ret < 0 && errno != EINTR)
+				err(EXIT_ERR, "poll() failed");
+			if (ret == 0) {
+				log_rotate(log);
+				size = 0;
+				continue;
+			}
+		}
+
+		ssize_t ret = sink_move(rfd, log->fd, NULL, 1024 * 1024);
+		if (ret < 0)
+			err(EXIT_ERR, "could not write log");
+		if (ret == 0)
+			break;
+
+		/* Only start the clock once something is written. */
+		if (size == 0)
+			opened = monotonic_time();
+		size += ret;
+
+		if (log->max_size && (size_t)size >= log->max_size) {
+			log_rotate(log);
+			size = 0;
+		}
+	}
+}
+
+/*
+ * Whether a --log-* setting was changed without a --log-to after it to use it.
+ * The sink is already running by then, so it'd be silently ignored otherwise.
+ */
+static bool log_config_unused = false;
+
+/* Send stdout & stderr to a rotated log in |dir|. */
+static void log_to(const char *dir)
+{
+	struct log_config *log = &log_config;
+
+	log_config_unused = false;
+
+	if (mkdir(dir, 0777) && errno != EEXIST)
+		err(EXIT_ERR, "could not create %s", dir);
+	log->dirfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (log->dirfd < 0)
+		err(EXIT_ERR, "could not open %s", dir);
+	if (log_open(log) < 0)
+		err(EXIT_ERR, "could not open log in %s", dir);
+
+	start_sink(1, 2, log_sink, log);
+
+	close(log->fd);
+	close(log->dirfd);
+	log->fd = log->dirfd = -1;
+}
+
+/* Settings for --capture-on-failure. */
+static size_t capture_size = 1024 * 1024;
+
+/*
+ * Whether --capture-size was changed without a --capture-on-failure after it to
+ * use it.  The supervisor is already running by then, so it'd be silently
+ * ignored otherwise.
+ */
+static bool capture_config_unused = false;
+
+/* Create an anonymous (in memory when possible) file to buffer output. */
+static int capture_buffer(void)
+{
+	int fd;
+
+#ifdef __linux__
+	fd = linux_memfd("nosig-capture");
+	if (fd >= 0)
+		return fd;
+#endif
+
+	FILE *fp = tmpfile();
+	if (fp == NULL)
+		err(EXIT_ERR, "could not create capture buffer");
+	fd = fileno(fp);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+/* Copy |len| bytes at |off| in |in| to the end of |out|. */
+static bool copy_range(int in, off_t off, size_t len, int out)
+{
+	while (len) {
+		ssize_t ret;
+
+#ifdef __linux__
+		ret = sendfile(out, in, &off, len);
+		if (ret > 0) {
+			len -= ret;
+			continue;
+		} else if (ret == 0 || (errno != EINVAL && errno != ENOSYS))
+			return false;
+#endif
+
+		char buf[64 * 1024];
+		ret = pread(in, buf, len > sizeof(buf) ? sizeof(buf) : len, off);
+		if (ret <= 0 || !write_all(out, buf, ret))
+			return false;
+		off += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+/*
+ * Send stdout & stderr into a ring buffer, and only write it to |path| if the
+ * program fails.  We have to stick around as a parent to see how it exits.
+ */
+static void capture_on_failure(const char *path)
+{
+	int pipefd[2];
+
+	capture_config_unused = false;
+
+	if (pipe(pipefd))
+		err(EXIT_ERR, "pipe() failed");
+	int buf = capture_buffer();
+
+	pid_t pid = start_supervised();
+	if (pid == 0) {
+		close(buf);
+		close(pipefd[0]);
+		if (dup2(pipefd[1], 1) == -1 || dup2(pipefd[1], 2) == -1)
+			err(EXIT_ERR, "could not dup output");
+		if (pipefd[1] > 2)
+			close(pipefd[1]);
+		return;
+	}
+	close(pipefd[1]);
+
+	/* Keep reading until EOF or the child exits & we've drained the pipe. */
+	off_t pos = 0;
+	bool wrapped = false, exited = false;
+	int status;
+	struct pollfd pfds[2] = {
+		{ .fd = pipefd[0], .events = POLLIN },
+		{ .fd = supervisor_pipe[0], .events = POLLIN },
+	};
+	while (true) {
+		int ret = poll(pfds, exited ? 1 : 2, exited ? 0 : -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_ERR, "poll() failed");
+		}
+		/* Don't wait on anything the child might have left running. */
+		if (exited && !pfds[0].revents)
+			break;
+
+		if (pfds[0].revents) {
+			ssize_t moved = sink_move(pipefd[0], buf, &pos, capture_size - pos);
+			if (moved < 0)
+				err(EXIT_ERR, "could not capture output");
+			else if (moved == 0)
+				break;
+			if ((size_t)pos == capture_size) {
+				pos = 0;
+				wrapped = true;
+			}
+		}
+
+		if (!exited && pfds[1].revents)
+			exited = supervised_exited(&status);
+	}
+	if (!exited)
+		status = wait_child(pid);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666);
+		if (fd < 0)
+			warn("could not open %s", path);
+		else {
+			/* Write out the oldest data first. */
+			if ((wrapped && !copy_range(buf, pos, capture_size - pos, fd)) ||
+			    !copy_range(buf, 0, pos, fd))
+				warn("could not write %s", path);
+			close(fd);
+		}
+	}
+
+	exit_like(status);
+}
+
+/*
+ * Open a --tee destination.  The |spec| takes the forms:
+ *   fd:N            Write to fd N.
+ *   unix:PATH       Connect to the UNIX stream socket at PATH.
+ *   PATH[:flags]    Open (and truncate) PATH.
+ */
+static void add_tee(const char *spec)
+{
+	int fd;
+
+	if (strncmp(spec, "fd:", 3) == 0) {
+		long oldfd = xatoi(&spec[3], 10);
+		if (oldfd < 0 || oldfd > INT_MAX)
+			errx(EXIT_ERR, "invalid fd: %s", &spec[3]);
+		fd = fcntl(oldfd, F_DUPFD_CLOEXEC, 3);
+		if (fd < 0)
+			err(EXIT_ERR, "could not dup %li", oldfd);
+	} else if (strncmp(spec, "unix:", 5) == 0) {
+		const char *path = &spec[5];
+		struct sockaddr_un sun;
+		if (strlen(path) >= sizeof(sun.sun_path))
+			errx(EXIT_ERR, "socket path too long: %s", path);
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			err(EXIT_ERR, "socket() failed");
+		if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)))
+			err(EXIT_ERR, "could not connect to %s", path);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	} else {
+		int flags;
+		char *path = split_path_flags(spec, &flags, O_WRONLY|O_CREAT|O_TRUNC);
+		fd = open(path, flags | O_CLOEXEC, 0666);
+		if (fd < 0)
+			err(EXIT_ERR, "could not open %s", path);
+		free(path);
+	}
+
+	int *new_fds = realloc(tee_fds, sizeof(*tee_fds) * (tee_cnt + 1));
+	if (new_fds == NULL)
+		err(EXIT_ERR, "realloc() failed");
+	tee_fds = new_fds;
+	tee_fds[tee_cnt++] = fd;
+}
+
+/* Move exactly |len| bytes from the pipe |rfd| to |wfd|. */
+static void move_exactly(int rfd, int wfd, size_t len)
+{
+	while (len) {
+		ssize_t ret = sink_move(rfd, wfd, NULL, len);
+		if (ret <= 0)
+			err(EXIT_ERR, "could not write output");
+		len -= ret;
+	}
+}
+
+/*
+ * The sink process for --tee.  Writes everything to the original stdout and
+ * all the other destinations.  Any failures kill the output like tee(1).
+ */
+static void tee_sink(int rfd, void *data)
+{
+	size_t i;
+	(void)data;
+
+#ifdef __linux__
+	/*
+	 * Use tee to duplicate the input into a scratch pipe for each destination
+	 * without consuming it, and then consume it with the final (original stdout)
+	 * destination.  This way the data never gets copied through userspace.
+	 */
+	int scratch[2];
+	if (pipe(scratch) == 0) {
+		while (true) {
+			ssize_t len;
+			do {
+				len = linux_tee(rfd, scratch[1], 1024 * 1024);
+			} while (len < 0 && errno == EINTR);
+			if (len == 0)
+				return;
+			else if (len < 0)
+				break;
+
+			/* The scratch pipe is empty each time, so tee always gets all of |len|. */
+			for (i = 0; i < tee_cnt; ++i) {
+				if (i && linux_tee(rfd, scratch[1], len) != len)
+					err(EXIT_ERR, "tee() failed");
+				move_exactly(scratch[0], tee_fds[i], len);
+			}
+			move_exactly(rfd, 1, len);
+		}
+		close(scratch[0]);
+		close(scratch[1]);
+	}
+#endif
+
+	char buf[64 * 1024];
+	while (true) {
+		ssize_t len = read(rfd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_ERR, "read() failed");
+		} else if (len == 0)
+			break;
+
+		for (i = 0; i < tee_cnt; ++i)
+			if (!write_all(tee_fds[i], buf, len))
+				err(EXIT_ERR, "could not write output");
+		if (!write_all(1, buf, len))
+			err(EXIT_ERR, "could not write output");
+	}
 }
 
-/* Return the symbolic signal name for |sig|. */
-static const char *strsigname(int sig)
+/* Start a sink to copy stdout to all the --tee destinations. */
+static void start_tee(void)
 {
 	size_t i;
 
-	/* Look up standard signals first. */
-	for (i = 0; i < ARRAY_SIZE(signals); ++i)
-		if (signals[i].value == sig)
-			return signals[i].name;
+	start_sink(1, -1, tee_sink, NULL);
 
-#if USE_RT
-	/* Fallback to realtime signals. */
-	if (sig == SIGRTMIN)
-		return "SIGRTMIN";
-	else if (sig == SIGRTMAX)
-		return "SIGRTMAX";
-	else if (sig > SIGRTMIN && sig < SIGRTMAX) {
-		static char sigrt[] = "SIGRTMIN+xx";
-		sprintf(&sigrt[9], "%i", sig);
-		return sigrt;
-	}
+	for (i = 0; i < tee_cnt; ++i)
+		close(tee_fds[i]);
+	tee_cnt = 0;
+}
+
+/* Settings for a --timestamp sink. */
+struct timestamp_config {
+	int fd;
+	const char *tag;
+	clockid_t clock;
+};
+
+/* Format the current time for |clock| into |buf|. */
+static void format_timestamp(char *buf, size_t len, clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+
+	if (clock == CLOCK_REALTIME) {
+		struct tm tm;
+		size_t off = strftime(buf, len, "%Y-%m-%d %H:%M:%S", localtime_r(&ts.tv_sec, &tm));
+		snprintf(&buf[off], len - off, ".%06li", (long)(ts.tv_nsec / 1000));
+	} else
+		snprintf(buf, len, "%lli.%06li", (long long)ts.tv_sec, (long)(ts.tv_nsec / 1000));
+}
+
+/* How many iovecs to batch up per writev call. */
+#if defined(IOV_MAX) && IOV_MAX < 256
+# define IOV_BATCH IOV_MAX
+#else
+# define IOV_BATCH 256
 #endif
 
-	return "SIG???";
+/* Write all of |iov| to |fd| handling partial writes. */
+static void writev_all(int fd, struct iovec *iov, int cnt)
+{
+	while (cnt) {
+		ssize_t ret = writev(fd, iov, cnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_ERR, "writev() failed");
+		}
+		while (cnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			++iov;
+			--cnt;
+		}
+		if (cnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+/* Queue up |len| bytes at |base| to write, and flush if the queue is full. */
+static void timestamp_queue(int fd, struct iovec *iov, int *cnt, const void *base, size_t len)
+{
+	iov[*cnt].iov_base = (void *)base;
+	iov[*cnt].iov_len = len;
+	if (++*cnt == IOV_BATCH) {
+		writev_all(fd, iov, *cnt);
+		*cnt = 0;
+	}
 }
 
 /*
- * Helpers to set signal dispositions via sigaction.
- *
- * Passing sa_handler/SIG_IGN/SIG_DFL as an argument is difficult due to lack
- * of a standard typedef in POSIX.  Let the compiler deal with optimization :P.
+ * The sink process for --timestamp.  Prefix each line with the time & the
+ * stream's tag.  All lines from the same read share the same timestamp, and
+ * all the output for a read is written in as few syscalls as possible.
  */
-static void _sigaction_range(struct sigaction *sa, int first, int last)
+static void timestamp_sink(int rfd, void *data)
 {
-	int sig;
-	for (sig = first; sig <= last; ++sig) {
-		if (sigaction(sig, sa, NULL)) {
-			/* SIGKILL/SIGSTOP trigger EINVAL.  Ignore by default. */
-			if (verbose || errno != EINVAL)
-				warn("sigaction(%s[%i]) failed", strsigname(sig), sig);
+	const struct timestamp_config *ts = data;
+	char buf[64 * 1024];
+	char prefix[64];
+	struct iovec iov[IOV_BATCH];
+	int cnt = 0;
+	bool line_start = true;
+
+	while (true) {
+		ssize_t len = read(rfd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_ERR, "read() failed");
+		} else if (len == 0)
+			break;
+
+		int prefix_len = 0;
+		const char *p = buf, *end = buf + len;
+		while (p < end) {
+			if (line_start) {
+				if (prefix_len == 0) {
+					char now[48];
+					format_timestamp(now, sizeof(now), ts->clock);
+					prefix_len = snprintf(prefix, sizeof(prefix), "%s %s: ", now, ts->tag);
+				}
+				timestamp_queue(ts->fd, iov, &cnt, prefix, prefix_len);
+			}
+
+			const char *nl = memchr(p, '\n', end - p);
+			const char *next = nl ? nl + 1 : end;
+			timestamp_queue(ts->fd, iov, &cnt, p, next - p);
+			line_start = nl != NULL;
+			p = next;
 		}
+
+		/* Flush everything before we reuse the buffers. */
+		writev_all(ts->fd, iov, cnt);
+		cnt = 0;
 	}
 }
-static void set_sigaction_ignore_range(struct sigaction *sa, int first, int last)
+
+/* Prefix stdout & stderr lines with timestamps using |mode| clock. */
+static void start_timestamps(const char *mode)
 {
-	sa->sa_handler = SIG_IGN;
-	_sigaction_range(sa, first, last);
+	static struct timestamp_config configs[2] = {
+		{ .fd = 1, .tag = "out", },
+		{ .fd = 2, .tag = "err", },
+	};
+	clockid_t clock;
+	size_t i;
+
+	if (streq(mode, "realtime"))
+		clock = CLOCK_REALTIME;
+	else if (streq(mode, "monotonic"))
+		clock = CLOCK_MONOTONIC;
+	else
+		errx(EXIT_ERR, "unknown timestamp mode (realtime or monotonic): %s", mode);
+
+	for (i = 0; i < ARRAY_SIZE(configs); ++i) {
+		configs[i].clock = clock;
+		start_sink(configs[i].fd, -1, timestamp_sink, &configs[i]);
+	}
 }
-static void set_sigaction_ignore(struct sigaction *sa, int sig)
+
+/* Create a listening socket for |spec| (tcp:HOST:PORT or unix:PATH). */
+static void add_listen(const char *spec)
 {
-	set_sigaction_ignore_range(sa, sig, sig);
+	int fd;
+
+	if (strncmp(spec, "unix:", 5) == 0) {
+		const char *path = &spec[5];
+		struct sockaddr_un sun;
+		struct stat st;
+
+		if (strlen(path) >= sizeof(sun.sun_path))
+			errx(EXIT_ERR, "socket path too long: %s", path);
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		strcpy(sun.sun_path, path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			err(EXIT_ERR, "socket() failed");
+
+		/*
+		 * Clean up stale sockets from previous runs, but nothing else.  If a
+		 * server still accepts connections on it, leave it alone.
+		 */
+		if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+			int cfd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (cfd < 0)
+				err(EXIT_ERR, "socket() failed");
+			if (connect(cfd, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+				errx(EXIT_ERR, "socket is in use by another server: %s", path);
+			else if (errno == ECONNREFUSED)
+				unlink(path);
+			close(cfd);
+		}
+		if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)))
+			err(EXIT_ERR, "could not bind %s", path);
+	} else if (strncmp(spec, "tcp:", 4) == 0) {
+		char *host = strdup(&spec[4]);
+		if (host == NULL)
+			err(EXIT_ERR, "strdup() failed");
+		char *port = strrchr(host, ':');
+		if (port == NULL)
+			errx(EXIT_ERR, "missing port (must be tcp:HOST:PORT): %s", spec);
+		*port++ = '\0';
+
+		/* Allow IPv6 addresses like [::1]. */
+		char *node = host;
+		size_t len = strlen(node);
+		if (len >= 2 && node[0] == '[' && node[len - 1] == ']') {
+			node[len - 1] = '\0';
+			++node;
+		}
+
+		struct addrinfo hints, *res, *ai;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		int ret = getaddrinfo(*node ? node : NULL, port, &hints, &res);
+		if (ret)
+			errx(EXIT_ERR, "could not resolve %s: %s", spec, gai_strerror(ret));
+
+		fd = -1;
+		for (ai = res; ai; ai = ai->ai_next) {
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd < 0)
+				continue;
+			/* Allow quick restarts while old connections linger. */
+			int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd < 0)
+			err(EXIT_ERR, "could not bind %s", spec);
+		free(host);
+	} else
+		errx(EXIT_ERR, "unknown listen spec (must be tcp:HOST:PORT or unix:PATH): %s", spec);
+
+	if (listen(fd, SOMAXCONN))
+		err(EXIT_ERR, "could not listen on %s", spec);
+
+	int *new_fds = realloc(listen_fds, sizeof(*listen_fds) * (listen_cnt + 1));
+	if (new_fds == NULL)
+		err(EXIT_ERR, "realloc() failed");
+	listen_fds = new_fds;
+	listen_fds[listen_cnt++] = fd;
 }
-static void set_sigaction_default_range(struct sigaction *sa, int first, int last)
+
+/* If a --listen socket is using |fd|, move it somewhere else. */
+static void move_listen_fd(int fd)
 {
-	sa->sa_handler = SIG_DFL;
-	_sigaction_range(sa, first, last);
+	size_t i;
+	for (i = 0; i < listen_cnt; ++i) {
+		if (listen_fds[i] != fd)
+			continue;
+		int newfd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+		if (newfd < 0)
+			err(EXIT_ERR, "could not dup listen fd");
+		close(fd);
+		listen_fds[i] = newfd;
+	}
 }
-static void set_sigaction_default(struct sigaction *sa, int sig)
+
+/*
+ * Pass the --listen sockets to the program using the socket activation
+ * protocol: the fds start at 3, and $LISTEN_FDS & $LISTEN_PID are set.
+ */
+static void pass_listen_fds(void)
 {
-	set_sigaction_default_range(sa, sig, sig);
+	size_t i;
+	int fd, last = 3 + (int)listen_cnt - 1;
+
+	/* Fds the user explicitly asked for can't be in two places at once. */
+	if (min_setup_fd <= last)
+		errx(EXIT_ERR, "--fd %i conflicts with the --listen sockets (fds 3-%i)",
+		     min_setup_fd, last);
+
+	/* Move them out of the way first so they don't clobber each other. */
+	for (i = 0; i < listen_cnt; ++i) {
+		fd = fcntl(listen_fds[i], F_DUPFD_CLOEXEC, last + 1);
+		if (fd < 0)
+			err(EXIT_ERR, "could not dup listen fd");
+		close(listen_fds[i]);
+		listen_fds[i] = fd;
+	}
+	/* The program might be run via --exec-fd, so move that too (w/out CLOEXEC). */
+	if (exec_fd >= 3 && exec_fd <= last) {
+		fd = fcntl(exec_fd, F_DUPFD, last + 1);
+		if (fd < 0)
+			err(EXIT_ERR, "could not dup exec fd");
+		close(exec_fd);
+		exec_fd = fd;
+	}
+	for (i = 0; i < listen_cnt; ++i) {
+		if (dup2(listen_fds[i], 3 + i) == -1)
+			err(EXIT_ERR, "could not dup to %zu", 3 + i);
+		close(listen_fds[i]);
+	}
+
+	/* The environment keeps pointers to these, so they have to stay around. */
+	static char fds_var[32], pid_var[32];
+	snprintf(fds_var, sizeof(fds_var), "LISTEN_FDS=%zu", listen_cnt);
+	env_set(fds_var);
+	snprintf(pid_var, sizeof(pid_var), "LISTEN_PID=%li", (long)getpid());
+	env_set(pid_var);
+	/* We don't set names, so don't let stale ones confuse things. */
+	env_unset("LISTEN_FDNAMES");
+
+	listen_cnt = 0;
 }
 
+#ifdef __linux__
+/* Settings for --trace-signals. */
+static bool trace_binary = false;
+
 /*
- * Helpers to set signal block masks.
- *
- * NB: The meaning of first/last is inverted from sigaction_range.  We use
- * sigfillset and then remove the [first,last] range rather than sigemptyset
- * and then adding the range.  This gives the C library a chance to filter out
- * any reserved realtime signals it might have.  This way our --block-all opts
- * will match behavior with manual --fill --block settings.
+ * Whether --trace-format was changed without a --trace-signals after it to use
+ * it.  The tracer is already running by then, so it'd be silently ignored
+ * otherwise.
  */
-static void sigprocmask_range(int how, int first, int last)
+static bool trace_config_unused = false;
+
+/*
+ * The --trace-format=binary record.  Everything is in native byte order, and
+ * the layout is fixed so tools can read it directly.
+ */
+struct trace_record {
+	uint64_t time_ns;	/* CLOCK_REALTIME */
+	int32_t tid;		/* The thread the signal was delivered to */
+	int32_t signo;
+	int32_t code;		/* si_code (e.g. SI_USER or SI_QUEUE) */
+	int32_t pid;		/* The sender (if si_code says there is one, else 0) */
+	uint32_t uid;
+	int32_t value;		/* si_value.sival_int for sigqueue */
+};
+static_assert(sizeof(struct trace_record) == 32, "trace record layout changed");
+
+static void trace_log(FILE *fp, pid_t tid, const siginfo_t *si)
 {
-	int sig;
-	sigset_t set;
-	sigfillset(&set);
-	for (sig = first; sig <= last; ++sig)
-		sigdelset(&set, sig);
-	if (sigprocmask(how, &set, 0))
-		warn("sigprocmask_range()");
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	/*
+	 * Only signals from processes (e.g. kill or sigqueue) & SIGCHLD have a
+	 * sender.  For others (e.g. SIGSEGV), the same space holds the address.
+	 */
+	bool sender = si->si_code <= 0 || si->si_signo == SIGCHLD;
+
+	if (trace_binary) {
+		struct trace_record rec = {
+			.time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+			.tid = tid,
+			.signo = si->si_signo,
+			.code = si->si_code,
+			.pid = sender ? si->si_pid : 0,
+			.uid = sender ? si->si_uid : 0,
+			.value = si->si_code == SI_QUEUE ? si->si_value.sival_int : 0,
+		};
+		fwrite(&rec, sizeof(rec), 1, fp);
+	} else if (sender) {
+		fprintf(fp, "%lli.%06li tid=%i sig=%s code=%i pid=%i uid=%u\n",
+		        (long long)ts.tv_sec, (long)(ts.tv_nsec / 1000), (int)tid,
+		        strsigname(si->si_signo), si->si_code, (int)si->si_pid,
+		        (unsigned)si->si_uid);
+	} else {
+		fprintf(fp, "%lli.%06li tid=%i sig=%s code=%i pid=- uid=-\n",
+		        (long long)ts.tv_sec, (long)(ts.tv_nsec / 1000), (int)tid,
+		        strsigname(si->si_signo), si->si_code);
+	}
 }
 
-/* Rebind |fd| to |path| using file |flags|. */
-static void redirect_io(int oldfd, const char *path, int flags)
+/*
+ * Run the program under ptrace and log every signal delivered to it (to any of
+ * its threads) to |arg|, then let it carry on as normal.  We stick around as
+ * the parent (and tracer) and exit the same way as the program.
+ */
+static void trace_signals(const char *arg)
 {
-	/* We use mode 666 to let umask apply. */
-	int newfd = open(path, flags, 0666);
-	if (newfd < 0)
+	int flags;
+
+	trace_config_unused = false;
+
+	char *path = split_path_flags(arg, &flags, O_WRONLY|O_CREAT|O_TRUNC);
+	int fd = open(path, flags | O_CLOEXEC, 0666);
+	if (fd < 0)
 		err(EXIT_ERR, "could not open %s", path);
-	/* Pathological edge case: if newfd is already oldfd, do nothing. */
-	if (newfd != oldfd) {
-		if (dup2(newfd, oldfd) == -1)
-			err(EXIT_ERR, "could not dup to %i", oldfd);
+	free(path);
+	FILE *fp = fdopen(fd, "w");
+	if (fp == NULL)
+		err(EXIT_ERR, "fdopen() failed");
+
+	/*
+	 * The child has to wait until we've attached so we don't miss anything.
+	 * If we couldn't (i.e. we exit w/out writing), it must not run untraced.
+	 */
+	int sync[2];
+	if (pipe(sync))
+		err(EXIT_ERR, "pipe() failed");
+
+	pid_t pid = start_supervised();
+	if (pid == 0) {
+		char c;
+		ssize_t ret;
+		fclose(fp);
+		close(sync[1]);
+		while ((ret = read(sync[0], &c, 1)) < 0 && errno == EINTR)
+			continue;
+		if (ret != 1)
+			_exit(EXIT_ERR);
+		close(sync[0]);
+		return;
+	}
+	close(sync[0]);
+
+	if (ptrace(PTRACE_SEIZE, pid, NULL,
+	           (void *)(PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL)))
+		err(EXIT_ERR, "could not trace the program");
+	if (write(sync[1], "", 1) != 1)
+		err(EXIT_ERR, "could not start the program");
+	close(sync[1]);
+
+	while (true) {
+		int status;
+		/* Only flush once we're idle so signal storms don't mean a write each. */
+		pid_t tid = waitpid(-1, &status, __WALL | WNOHANG);
+		if (tid == 0) {
+			fflush(fp);
+			tid = waitpid(-1, &status, __WALL);
+		}
+		if (tid < 0) {
+			if (errno == EINTR)
+				continue;
+			err(EXIT_ERR, "waitpid() failed");
+		}
+
+		if (!WIFSTOPPED(status)) {
+			if (tid != pid)
+				continue;
+			if (fclose(fp))
+				warn("could not write signal trace");
+			exit_like(status);
+		}
+
+		int sig = WSTOPSIG(status);
+		int event = (unsigned)status >> 16;
+		if (event == PTRACE_EVENT_STOP) {
+			/* Group-stops (e.g. SIGSTOP) need to stay stopped until SIGCONT. */
+			if (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU)
+				ptrace(PTRACE_LISTEN, tid, NULL, NULL);
+			else
+				ptrace(PTRACE_CONT, tid, NULL, NULL);
+		} else if (event) {
+			/* New threads & execs. */
+			ptrace(PTRACE_CONT, tid, NULL, NULL);
+		} else {
+			/* A signal-delivery-stop, so log & deliver it. */
+			siginfo_t si;
+			if (ptrace(PTRACE_GETSIGINFO, tid, NULL, &si) == 0)
+				trace_log(fp, tid, &si);
+			ptrace(PTRACE_CONT, tid, NULL, (void *)(intptr_t)sig);
+		}
 	}
 }
-static void redirect_input_from(const char *path)
-{
-	redirect_io(0, path, O_RDONLY);
-}
-static void redirect_output_to(int oldfd, const char *path)
-{
-	redirect_io(oldfd, path, O_WRONLY|O_CREAT);
-}
+#endif
 
-/* Print a single signal with consistent output format/alignment. */
-static void list_one_signal(const char *name, int value)
+/* Format all the names of |sig| (comma separated) into |buf|. */
+static void signal_names(int sig, char *buf, size_t size)
 {
-	/* 15 should be bigger than all signals we know about. */
-	const int signame_width = 15;
-	printf("%-*s %2i   %s\n", signame_width, name, value, strsignal(value));
+	size_t i, len = 0;
+
+	/* The canonical name first, then any aliases. */
+	const char *name = strsigname(sig);
+	buf[0] = '\0';
+	if (!streq(name, "SIG???"))
+		len += snprintf(buf, size, "%s", name);
+	for (i = 0; i < signals_cnt && len < size; ++i)
+		if (signals[i].value == sig && !streq(signals[i].name, name))
+			len += snprintf(&buf[len], size - len, "%s%s", len ? "," : "",
+			                signals[i].name);
+
+#if USE_RT
+	/* Realtime signals may also be named relative to the other end. */
+	if (len < size && sig >= SIGRTMIN && sig < SIGRTMAX)
+		snprintf(&buf[len], size - len, ",SIGRTMAX-%i", SIGRTMAX - sig);
+	else if (len < size && sig == SIGRTMAX && SIGRTMAX != SIGRTMIN)
+		snprintf(&buf[len], size - len, ",SIGRTMIN+%i", SIGRTMAX - SIGRTMIN);
+#endif
 }
 
-/* Print all the known signals names to stdout. */
+/*
+ * Print the known signals (optionally only those in |ranges| like "1-15,34")
+ * sorted by number with all their names grouped together.  Each line has the
+ * number, the names, the realtime offset (from SIGRTMIN, or - for standard
+ * signals), and the description.
+ */
 ATTR_NORETURN
-static void list_signals(void)
+static void list_signals(const char *ranges)
 {
-	size_t i;
-
-	for (i = 0; i < ARRAY_SIZE(signals); ++i)
-		list_one_signal(signals[i].name, signals[i].value);
+	int sig, sigmax = get_sigmax();
+	bool *want = calloc(sigmax + 1, sizeof(*want));
+	if (want == NULL)
+		err(EXIT_ERR, "calloc() failed");
+
+	if (ranges) {
+		char *copy = strdup(ranges), *tok, *saveptr;
+		if (copy == NULL)
+			err(EXIT_ERR, "strdup() failed");
+		for (tok = strtok_r(copy, ",", &saveptr); tok;
+		     tok = strtok_r(NULL, ",", &saveptr)) {
+			long first, last;
+			parse_range(tok, &first, &last);
+			if (first < 1 || last < first || last > sigmax)
+				errx(EXIT_ERR, "invalid signal range: %s", ranges);
+			for (; first <= last; ++first)
+				want[first] = true;
+		}
+		free(copy);
+	} else
+		memset(want, true, sizeof(*want) * (sigmax + 1));
+
+	/* Figure out the widest names so the columns line up. */
+	char names[128];
+	int width = 0;
+	for (sig = 1; sig <= sigmax; ++sig) {
+		if (!want[sig])
+			continue;
+		signal_names(sig, names, sizeof(names));
+		if ((int)strlen(names) > width)
+			width = strlen(names);
+	}
 
+	/* Build it all up in memory and write it out at once. */
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		err(EXIT_ERR, "open_memstream() failed");
+	for (sig = 1; sig <= sigmax; ++sig) {
+		if (!want[sig])
+			continue;
+		/* Skip numbers without any names (e.g. reserved realtime signals). */
+		signal_names(sig, names, sizeof(names));
+		if (names[0] == '\0')
+			continue;
+		fprintf(fp, "%2i  %-*s  ", sig, width, names);
 #if USE_RT
-	list_one_signal("SIGRTMIN", SIGRTMIN);
-	for (i = 0; i <= (size_t)(SIGRTMAX - SIGRTMIN); ++i) {
-		static char signame[] = "SIGRTMIN+xx";
-		sprintf(&signame[9], "%zu", i);
-		list_one_signal(signame, SIGRTMIN + i);
+		if (sig >= SIGRTMIN)
+			fprintf(fp, "%3i", sig - SIGRTMIN);
+		else
+#endif
+			fprintf(fp, "%3s", "-");
+		fprintf(fp, "  %s\n", strsignal(sig));
 	}
+	if (fclose(fp))
+		err(EXIT_ERR, "could not format signal list");
 
-	list_one_signal("SIGRTMAX", SIGRTMAX);
-	for (i = 0; i <= (size_t)(SIGRTMAX - SIGRTMIN); ++i) {
-		static char signame[] = "SIGRTMAX+xx";
-		sprintf(&signame[9], "%zu", i);
-		list_one_signal(signame, SIGRTMAX - i);
-	}
-#endif
+	if (!write_all(1, buf, len))
+		err(EXIT_ERR, "could not write signal list");
 
 	exit(EXIT_OK);
 }
@@ -432,7 +3179,7 @@ static void show_status(void)
 }
 
 /* Command line option settings. */
-#define short_options "a:d:efbusI:D:vlVh"
+#define short_options "a:d:efbusI:D:S:vl::Vh"
 #define a_argument required_argument
 enum {
 	ONLY_LONG_OPTS_BASE = 0x100,
@@ -455,6 +3202,41 @@ enum {
 	OPT_STDERR,
 	OPT_OUTPUT,
 	OPT_NULL_IO,
+	OPT_FD,
+	OPT_PIPE_SIZE,
+	OPT_LOG_TO,
+	OPT_LOG_SIZE,
+	OPT_LOG_AGE,
+	OPT_LOG_KEEP,
+	OPT_TEE,
+	OPT_TIMESTAMP,
+	OPT_CAPTURE,
+	OPT_CAPTURE_SIZE,
+	OPT_TRACE_SIGNALS,
+	OPT_TRACE_FORMAT,
+	OPT_UNSET,
+	OPT_CLEAR_ENV,
+	OPT_SETSID,
+	OPT_SETPGID,
+	OPT_FOREGROUND,
+	OPT_RLIMIT,
+	OPT_NICE,
+	OPT_SCHED,
+	OPT_CPUS,
+	OPT_MEMBIND,
+	OPT_INTERLEAVE,
+	OPT_PREFERRED,
+	OPT_DISABLE_THP,
+	OPT_TIMER_SLACK,
+	OPT_IOPRIO,
+	OPT_OOM_SCORE_ADJ,
+	OPT_CGROUP,
+	OPT_WARM,
+	OPT_EXEC_FD,
+	OPT_EXEC_PATH,
+	OPT_CLOSE_FDS,
+	OPT_KEEP_FDS,
+	OPT_LISTEN,
 };
 static const struct option options[] = {
 	{"reset",             no_argument, NULL, OPT_RESET_ALL},
@@ -496,10 +3278,69 @@ static const struct option options[] = {
 	{"stderr",             a_argument, NULL, OPT_STDERR},
 	{"output",             a_argument, NULL, OPT_OUTPUT},
 	{"null-io",           no_argument, NULL, OPT_NULL_IO},
+	{"fd",                 a_argument, NULL, OPT_FD},
+#ifdef __linux__
+	{"pipe-size",          a_argument, NULL, OPT_PIPE_SIZE},
+#endif
+	{"log-to",             a_argument, NULL, OPT_LOG_TO},
+	{"log-size",           a_argument, NULL, OPT_LOG_SIZE},
+	{"log-age",            a_argument, NULL, OPT_LOG_AGE},
+	{"log-keep",           a_argument, NULL, OPT_LOG_KEEP},
+	{"tee",                a_argument, NULL, OPT_TEE},
+	{"timestamp",          a_argument, NULL, OPT_TIMESTAMP},
+	{"capture-on-failure", a_argument, NULL, OPT_CAPTURE},
+	{"capture-size",       a_argument, NULL, OPT_CAPTURE_SIZE},
+#ifdef __linux__
+	{"trace-signals",      a_argument, NULL, OPT_TRACE_SIGNALS},
+	{"trace-format",       a_argument, NULL, OPT_TRACE_FORMAT},
+#endif
+
+	{"close-fds",         no_argument, NULL, OPT_CLOSE_FDS},
+	{"keep-fds",           a_argument, NULL, OPT_KEEP_FDS},
+	{"listen",             a_argument, NULL, OPT_LISTEN},
+
+	{"unset",              a_argument, NULL, OPT_UNSET},
+	{"clear-env",         no_argument, NULL, OPT_CLEAR_ENV},
+
+	{"setsid",            no_argument, NULL, OPT_SETSID},
+	{"setpgid",           no_argument, NULL, OPT_SETPGID},
+	{"foreground",        no_argument, NULL, OPT_FOREGROUND},
 
+	{"rlimit",             a_argument, NULL, OPT_RLIMIT},
+	{"nice",               a_argument, NULL, OPT_NICE},
+#ifdef __linux__
+	{"sched",              a_argument, NULL, OPT_SCHED},
+	{"cpus",               a_argument, NULL, OPT_CPUS},
+#endif
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+	{"membind",            a_argument, NULL, OPT_MEMBIND},
+	{"interleave",         a_argument, NULL, OPT_INTERLEAVE},
+	{"preferred",          a_argument, NULL, OPT_PREFERRED},
+#endif
+#ifdef __linux__
+# ifdef PR_SET_THP_DISABLE
+	{"disable-thp",       no_argument, NULL, OPT_DISABLE_THP},
+# endif
+# ifdef PR_SET_TIMERSLACK
+	{"timer-slack",        a_argument, NULL, OPT_TIMER_SLACK},
+# endif
+# ifdef SYS_ioprio_set
+	{"ioprio",             a_argument, NULL, OPT_IOPRIO},
+# endif
+	{"oom-score-adj",      a_argument, NULL, OPT_OOM_SCORE_ADJ},
+#endif
+	{"cgroup",             a_argument, NULL, OPT_CGROUP},
+
+	{"exec-fd",            a_argument, NULL, OPT_EXEC_FD},
+	{"exec-path",          a_argument, NULL, OPT_EXEC_PATH},
+#ifdef __linux__
+	{"warm",              no_argument, NULL, OPT_WARM},
+#endif
+
+	{"split-string",       a_argument, NULL, 'S'},
 	{"verbose",           no_argument, NULL, 'v'},
 	{"show-status",       no_argument, NULL, OPT_SHOW_STATUS},
-	{"list",              no_argument, NULL, 'l'},
+	{"list",        optional_argument, NULL, 'l'},
 	{"version",           no_argument, NULL, 'V'},
 	{"help",              no_argument, NULL, 'h'},
 
@@ -547,10 +3388,69 @@ static const char * const help_text[] = {
 	"Redirect stderr to the specified path",
 	"Redirect stdout & stderr to the specified path",
 	"Redirect stdin/stdout/stderr to /dev/null",
+	"Set up fd N (N=path[:flags] or N=fd:M)",
+#ifdef __linux__
+	"Resize stdout/stderr pipes to this many bytes",
+#endif
+	"Send stdout & stderr to a rotated log in this dir",
+	"Rotate the --log-to log at this size",
+	"Rotate the --log-to log after this many seconds",
+	"Number of old --log-to logs to keep",
+	"Also copy stdout to path, fd:N, or unix:path",
+	"Prefix output lines with realtime/monotonic times",
+	"Save stdout & stderr to the path only if the program fails",
+	"Max output for --capture-on-failure to save",
+#ifdef __linux__
+	"Log all signals delivered to the program to the path",
+	"Format for --trace-signals: text or binary",
+#endif
+
+	"Close all fds except stdin/stdout/stderr & --keep-fds",
+	"List of fds for --close-fds to keep (e.g. 3,5-7)",
+	"Pass a listening tcp:HOST:PORT or unix:PATH socket",
+
+	"Remove the variable from the environment",
+	"Start with an empty environment",
+
+	"Run in a new session (detach from the terminal)",
+	"Run in a new process group",
+	"Make the process group the terminal's foreground",
+
+	"Set a resource limit (e.g. NOFILE=1024:4096)",
+	"Adjust the niceness by this amount",
+#ifdef __linux__
+	"Set the scheduling policy (e.g. batch or fifo:10)",
+	"Only run on these CPUs (e.g. 0,2-3 or llc:0)",
+#endif
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+	"Only allocate memory from these NUMA nodes",
+	"Interleave memory allocations across these NUMA nodes",
+	"Prefer allocating memory from this NUMA node",
+#endif
+#ifdef __linux__
+# ifdef PR_SET_THP_DISABLE
+	"Disable transparent huge pages",
+# endif
+# ifdef PR_SET_TIMERSLACK
+	"Set the timer slack (in ns)",
+# endif
+# ifdef SYS_ioprio_set
+	"Set the I/O priority (e.g. idle or be:7)",
+# endif
+	"Adjust the OOM killer score (-1000 to 1000)",
+#endif
+	"Run the program in this cgroup (v2) directory",
+
+	"Run the program via this open fd",
+	"Run the program at this path (skip $PATH search)",
+#ifdef __linux__
+	"Prefetch the program & its libraries into the cache",
+#endif
 
+	"Split the string into more options (for shebangs)",
 	"Display verbose internal nosig output",
 	"Display current signal settings (meant for debugging)",
-	"List all known signals",
+	"List known signals (filter as -l1-15, not -l 1-15)",
 	"Show version info and exit",
 	"This help text",
 };
@@ -586,7 +3486,7 @@ static void show_usage(int status)
 	);
 
 	/* Print out all the options dynamically, and with alignment. */
-	const int minpad = 25;
+	const int minpad = 33;
 	for (i = 0; i < ARRAY_SIZE(help_text); ++i) {
 		int pad;
 
@@ -594,9 +3494,9 @@ static void show_usage(int status)
 			pad = fprintf(fp, "  -%c, ", options[i].val);
 		else
 			pad = fprintf(fp, "      ");
-		pad += fprintf(fp, "--%s ", options[i].name);
-		if (options[i].has_arg == a_argument)
-			pad += fprintf(fp, "<arg> ");
+		pad += fprintf(fp, "--%s%s ", options[i].name,
+		               options[i].has_arg == a_argument ? " <arg>" :
+		               options[i].has_arg == optional_argument ? "[=<arg>]" : "");
 		/* This assert is more of a reminder to update the constant. */
 		assert(pad <= minpad);
 		fprintf(fp, "%*s%s\n", minpad - pad, "", help_text[i]);
@@ -617,12 +3517,25 @@ int main(int argc, char *argv[])
 	int c;
 	sigset_t set;
 	struct sigaction sa;
+	const char *argv0 = argv[0];
 
-	sigemptyset(&set);
+	if (!signames_init())
+		err(EXIT_ERR, "signames_init() failed");
 
 	memset(&sa, 0, sizeof(sa));
 	sigfillset(&sa.sa_mask);
 
+ parse_args:
+	/* Each (nested) invocation starts off with a clean slate. */
+	sigemptyset(&set);
+	exec_path = NULL;
+	/* An outer --exec-fd was only used to run us, so don't leak it. */
+	if (exec_fd > STDERR_FILENO)
+		close(exec_fd);
+	exec_fd = -1;
+	keep_fds_cnt = 0;
+	optind = 0;
+
 	/* Process the command line. */
 	while ((c = getopt_long(argc, argv, "+" short_options, options, NULL)) != -1) {
 		switch (c) {
@@ -633,6 +3546,11 @@ int main(int argc, char *argv[])
 		case 'v':
 			++verbose;
 			break;
+		case 'S':
+			/* Restart option parsing with the new argv. */
+			split_args(&argc, &argv, optind, optarg);
+			optind = 0;
+			break;
 
 		case 'a':
 			sigaddset(&set, get_signal_num(optarg));
@@ -738,11 +3656,163 @@ int main(int argc, char *argv[])
 			redirect_output_to(1, "/dev/null");
 			redirect_output_to(2, "/dev/null");
 			break;
+		case OPT_FD:
+			setup_fd(optarg);
+			break;
+#ifdef __linux__
+		case OPT_PIPE_SIZE:
+			set_pipe_size(optarg);
+			break;
+#endif
+		case OPT_LISTEN:
+			add_listen(optarg);
+			break;
+		case OPT_TEE:
+			add_tee(optarg);
+			break;
+		case OPT_TIMESTAMP:
+			start_timestamps(optarg);
+			break;
+		case OPT_CAPTURE:
+			capture_on_failure(optarg);
+			break;
+		case OPT_CAPTURE_SIZE:
+			capture_size = xatosize(optarg);
+			if (capture_size == 0)
+				errx(EXIT_ERR, "capture size must be non-zero");
+			capture_config_unused = true;
+			break;
+#ifdef __linux__
+		case OPT_TRACE_SIGNALS:
+			trace_signals(optarg);
+			break;
+		case OPT_TRACE_FORMAT:
+			if (streq(optarg, "text"))
+				trace_binary = false;
+			else if (streq(optarg, "binary"))
+				trace_binary = true;
+			else
+				errx(EXIT_ERR, "unknown trace format: %s", optarg);
+			trace_config_unused = true;
+			break;
+#endif
+		case OPT_LOG_TO:
+			log_to(optarg);
+			break;
+		case OPT_LOG_SIZE:
+			log_config.max_size = xatosize(optarg);
+			log_config_unused = true;
+			break;
+		case OPT_LOG_AGE: {
+			long age = xatoi(optarg, 10);
+			if (age < 0)
+				errx(EXIT_ERR, "invalid log age: %s", optarg);
+			log_config.max_age = age;
+			log_config_unused = true;
+			break;
+		}
+		case OPT_LOG_KEEP: {
+			long keep = xatoi(optarg, 10);
+			if (keep < 0)
+				errx(EXIT_ERR, "invalid log count: %s", optarg);
+			log_config.keep = keep;
+			log_config_unused = true;
+			break;
+		}
+
+		case OPT_CLOSE_FDS:
+			close_fds();
+			break;
+		case OPT_KEEP_FDS:
+			parse_keep_fds(optarg);
+			break;
+
+		case OPT_UNSET:
+			env_unset(optarg);
+			break;
+		case OPT_CLEAR_ENV:
+			env_clear();
+			break;
+
+		case OPT_SETSID:
+			start_session();
+			break;
+		case OPT_SETPGID:
+			start_process_group();
+			break;
+		case OPT_FOREGROUND:
+			set_foreground();
+			break;
+
+		case OPT_RLIMIT:
+			set_rlimit(optarg);
+			break;
+		case OPT_NICE:
+			set_nice(optarg);
+			break;
+#ifdef __linux__
+		case OPT_SCHED:
+			set_sched(optarg);
+			break;
+		case OPT_CPUS:
+			set_cpus(optarg);
+			break;
+#endif
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+		case OPT_MEMBIND:
+			set_mempolicy_nodes(NOSIG_MPOL_BIND, optarg);
+			break;
+		case OPT_INTERLEAVE:
+			set_mempolicy_nodes(NOSIG_MPOL_INTERLEAVE, optarg);
+			break;
+		case OPT_PREFERRED:
+			set_mempolicy_nodes(NOSIG_MPOL_PREFERRED, optarg);
+			break;
+#endif
+#ifdef __linux__
+# ifdef PR_SET_THP_DISABLE
+		case OPT_DISABLE_THP:
+			disable_thp();
+			break;
+# endif
+# ifdef PR_SET_TIMERSLACK
+		case OPT_TIMER_SLACK:
+			set_timer_slack(optarg);
+			break;
+# endif
+# ifdef SYS_ioprio_set
+		case OPT_IOPRIO:
+			set_ioprio(optarg);
+			break;
+# endif
+		case OPT_OOM_SCORE_ADJ:
+			set_oom_score_adj(optarg);
+			break;
+#endif
+		case OPT_CGROUP:
+			set_cgroup(optarg);
+			break;
+
+		case OPT_EXEC_FD:
+			exec_fd = xatoi(optarg, 10);
+			if (exec_fd < 0 || fcntl(exec_fd, F_GETFD) == -1)
+				errx(EXIT_ERR, "invalid fd: %s", optarg);
+			exec_path = NULL;
+			break;
+		case OPT_EXEC_PATH:
+			exec_path = optarg;
+			exec_fd = -1;
+			break;
+#ifdef __linux__
+		case OPT_WARM:
+			warm = true;
+			break;
+#endif
 
 		case OPT_SHOW_STATUS:
 			show_status();
 		case 'l':
-			list_signals();
+			list_signals(optarg);
 		case 'V':
 			show_version();
 		case 'h':
@@ -756,8 +3826,54 @@ int main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	/* Like env, leading NAME=VALUE settings update the environment. */
+	while (argc && strchr(argv[0], '=')) {
+		env_set(argv[0]);
+		--argc;
+		++argv;
+	}
+
+	/*
+	 * If we're about to run ourselves (e.g. wrapper scripts calling wrapper
+	 * scripts), process the nested options directly instead.  All the state
+	 * we manage is inherited across exec, so the result is the same, but we
+	 * skip the exec & startup overhead for every nested level.
+	 */
+	if (argc && is_self(argv0, argv[0])) {
+		if (verbose)
+			warnx("folding nested invocation: %s", argv[0]);
+		verbose = 0;
+		goto parse_args;
+	}
+
+	if (log_config_unused)
+		errx(EXIT_ERR, "--log-size, --log-age, & --log-keep must come before --log-to");
+	if (capture_config_unused)
+		errx(EXIT_ERR, "--capture-size must come before --capture-on-failure");
+#ifdef __linux__
+	if (trace_config_unused)
+		errx(EXIT_ERR, "--trace-format must come before --trace-signals");
+#endif
+
 	if (argc) {
-		execvp(argv[0], argv);
+#ifdef __linux__
+		/*
+		 * The program is only known once all the options have been processed,
+		 * so this happens just before exec.  The reads continue in the background
+		 * while the program (and its dynamic linker) starts up.
+		 */
+		if (warm)
+			warm_prog(argv[0]);
+#endif
+		/* All the --tee destinations share one sink, so start it at the end. */
+		if (tee_cnt)
+			start_tee();
+		if (cgroup_fd >= 0)
+			enter_cgroup();
+		if (listen_cnt)
+			pass_listen_fds();
+
+		exec_prog(argv);
 		/*
 		 * Use exit status like POSIX/bash/nohup/env/etc...
 		 * https://pubs.opengroup.org/onlinepubs/009695399/utilities/env.html#tag_04_43_14
@@ -769,7 +3885,7 @@ int main(int argc, char *argv[])
 			status = EXIT_PROG_NOT_EXEC;
 		else
 			status = EXIT_ERR;
-		err(status, "%s", argv[0]);
+		err(status, "%s", exec_path ? exec_path : argv[0]);
 	} else
 		errx(EXIT_ERR, "missing program to run");
 }
@@ -0,0 +1,159 @@
+/*
+ * Symbolic signal names shared by nosig & the benchmark in tests/.
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signames.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/*
+ * List of all signals binding symbolic names to numerical value.
+ *
+ * nosig's list_signals sorts by number itself, so the order here only
+ * matters to give priority for certain signal names over others when the names
+ * resolve to the same number (the first one is the canonical name).
+ *
+ * ifdef protection is used only for signal names not defined by POSIX.
+ * https://pubs.opengroup.org/onlinepubs/9699919799/basedefs/signal.h.html
+ * Non-POSIX targets are a non-goal of the project (i.e. Windows).  Additional
+ * non-standard signals may be added if they're used by a common OS (i.e. BSD).
+ *
+ * NB: In a pinch, users may always user a signal by number, so listing the
+ * symbolic name here is not super critical to use.
+ *
+ * NB: SIGRT{MIN,MAX} as specifically omitted from this list.  This only tracks
+ * constant signals and SIGRT{MIN,MAX} are allowed to be dynamic as the OS is
+ * allowed to reserve from that range thereby adjusting their value.  We parse
+ * those signal names on the fly rather than use a lookup table.
+ */
+#define P(s) { #s, s }
+const struct signame signals[] = {
+	P(SIGHUP),
+	P(SIGINT),
+	P(SIGQUIT),
+	P(SIGILL),
+	P(SIGTRAP),
+	P(SIGABRT),
+#ifdef SIGIOT
+	P(SIGIOT),
+#endif
+	P(SIGBUS),
+	P(SIGFPE),
+	P(SIGKILL),
+	P(SIGUSR1),
+	P(SIGSEGV),
+	P(SIGUSR2),
+	P(SIGPIPE),
+	P(SIGALRM),
+	P(SIGTERM),
+#ifdef SIGSTKFLT
+	P(SIGSTKFLT),
+#endif
+	P(SIGCHLD),
+	P(SIGCONT),
+	P(SIGSTOP),
+	P(SIGTSTP),
+	P(SIGTTIN),
+	P(SIGTTOU),
+	P(SIGURG),
+	P(SIGXCPU),
+	P(SIGXFSZ),
+	P(SIGVTALRM),
+	P(SIGPROF),
+#ifdef SIGWINCH
+	P(SIGWINCH),
+#endif
+#ifdef SIGIO
+	P(SIGIO),
+#endif
+	P(SIGPOLL),
+#ifdef SIGPWR
+	P(SIGPWR),
+#endif
+	P(SIGSYS),
+#ifdef SIGEMT
+	P(SIGEMT),
+#endif
+#ifdef SIGUNUSED
+	P(SIGUNUSED),
+#endif
+};
+#undef P
+const size_t signals_cnt = ARRAY_SIZE(signals);
+
+int get_sigmax(void)
+{
+#if USE_RT
+	return SIGRTMAX;
+#else
+	size_t i;
+	int sig = 1;
+
+	for (i = 0; i < ARRAY_SIZE(signals); ++i)
+		if (sig < signals[i].value)
+			sig = signals[i].value;
+
+	return sig;
+#endif
+}
+
+/*
+ * Dense table of names for all signals (standard & realtime) indexed by signal
+ * number.  It's built once at startup as SIGRTMIN & SIGRTMAX might not be
+ * constants, and never modified after that, so it's safe to read from anywhere.
+ */
+static const char **signames = NULL;
+
+bool signames_init(void)
+{
+	int sigmax = get_sigmax();
+	size_t i;
+
+	const char **names = calloc(sigmax + 1, sizeof(*names));
+	if (names == NULL)
+		return false;
+
+	/* Walk backwards so earlier names take priority for the same number. */
+	for (i = ARRAY_SIZE(signals); i-- > 0; )
+		if (signals[i].value <= sigmax)
+			names[signals[i].value] = signals[i].name;
+
+#if USE_RT
+	/* Long enough for "SIGRTMIN+" and any offset. */
+	enum { RTNAME_LEN = 24 };
+	int sig, rtcnt = SIGRTMAX - SIGRTMIN + 1;
+	char *buf = malloc(rtcnt * RTNAME_LEN);
+	if (buf == NULL) {
+		free(names);
+		return false;
+	}
+	for (sig = SIGRTMIN; sig <= SIGRTMAX; ++sig) {
+		char *name = &buf[(sig - SIGRTMIN) * RTNAME_LEN];
+		if (sig == SIGRTMIN)
+			strcpy(name, "SIGRTMIN");
+		else if (sig == SIGRTMAX)
+			strcpy(name, "SIGRTMAX");
+		else
+			snprintf(name, RTNAME_LEN, "SIGRTMIN+%i", sig - SIGRTMIN);
+		names[sig] = name;
+	}
+#endif
+
+	signames = names;
+	return true;
+}
+
+const char *strsigname(int sig)
+{
+	if (sig > 0 && sig <= get_sigmax() && signames[sig])
+		return signames[sig];
+	return "SIG???";
+}
@@ -0,0 +1,40 @@
+/*
+ * Symbolic signal names shared by nosig & the benchmark in tests/.
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+#ifndef NOSIG_SIGNAMES_H
+#define NOSIG_SIGNAMES_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* macOS doesn't support realtime signals as they were optional. */
+#if defined(SIGRTMIN) && defined(SIGRTMAX)
+# define USE_RT 1
+#else
+# define USE_RT 0
+#endif
+
+struct signame {
+	const char *name;
+	int value;
+};
+
+/* All the constant signals (see signames.c); names include the "SIG". */
+extern const struct signame signals[];
+extern const size_t signals_cnt;
+
+/* POSIX does not make it easy to figure out how many signals are supported. */
+int get_sigmax(void);
+
+/* Build the strsigname table.  Must be called once before using it. */
+bool signames_init(void);
+
+/* Return the symbolic signal name for |sig|, or "SIG???" if it's unknown. */
+const char *strsigname(int sig);
+
+#endif
@@ -152,6 +152,33 @@ if [ "${SIG_RT}" = "yes" ]; then
 	check_exit 125 --ignore SIGRTMAX-1000 true
 fi
 
+: "### Check signal names"
+if [ "${SIG_RT}" = "yes" ]; then
+	# Realtime signals are named by their offset, not their number.
+	rtmin=$(nosig --list | awk '$2 ~ /^SIGRTMIN,/ { print $1 }')
+	rtmax=$(nosig --list | awk '$2 ~ /^SIGRTMAX,/ { print $1 }')
+	out=$(nosig -vv --show-status)
+	[[ ${out} == *" dSIGRTMIN[${rtmin}] "* ]]
+	[[ ${out} == *" dSIGRTMIN+1[$(( rtmin + 1 ))] "* ]]
+	[[ ${out} == *" dSIGRTMIN+2[$(( rtmin + 2 ))] "* ]]
+	[ "$(nosig --list=$(( rtmax - 1 )) | awk '{print $2, $3}')" = \
+	  "SIGRTMIN+$(( rtmax - rtmin - 1 )),SIGRTMAX-1 $(( rtmax - rtmin - 1 ))" ]
+fi
+sigint=$(nosig --list | awk '$2 == "SIGINT" { print $1 }')
+[[ $(nosig -vv --show-status) == *" dSIGINT[${sigint}] "* ]]
+
+: "### Check signal listing"
+# Sorted by number without duplicates.
+nosig --list | awk '{print $1}' | sort -c -n -u
+# Aliases are grouped.
+[ "$(nosig --list | grep -c -w -e SIGABRT -e SIGIOT)" = "1" ]
+[ "$(nosig --list=${sigint} | awk '{print $1, $2, $3}')" = "${sigint} SIGINT -" ]
+[ "$(nosig --list=1-3,${sigint} | wc -l)" = "3" ]
+[ "$(nosig -l1 | wc -l)" = "1" ]
+check_exit 125 --list=0
+check_exit 125 --list=3-1
+check_exit 125 --list=foo
+
 : "### Dump state for logging/triaging in case of failure"
 nosig --reset -vv --show-status
 nosig --show-status
@@ -341,6 +368,472 @@ check_exit ${sigret} --reset --ignore INT --default INT sh -c 'kill -INT $$; exi
 check_exit 2 --reset --ignore 2 sh -c 'kill -INT $$; exit 2'
 check_exit ${sigret} --reset --ignore 2 --default INT sh -c 'kill -INT $$; exit 2'
 
+: "### Check nested invocations are folded"
+out=$(nosig -v --ignore INT "${NOSIG}" true 2>&1)
+[[ ${out} == *"folding nested invocation"* ]]
+check_exit 2 --reset --ignore INT "${NOSIG}" --ignore TERM sh -c 'kill -INT $$; kill -TERM $$; exit 2'
+check_exit 2 --reset --add INT --block "${NOSIG}" --add TERM --block sh -c 'kill -INT $$; kill -TERM $$; exit 2'
+[ "$(nosig --ignore INT "${NOSIG}" --show-status)" = "$(nosig --ignore INT --show-status)" ]
+check_exit 125 "${NOSIG}" --badflag
+check_exit 125 "${NOSIG}"
+
+: "### Check -S splitting"
+check_exit 2 -S '--ignore INT -- sh -c' 'kill -INT $$; exit 2'
+check_exit 2 -S "--ignore INT -- sh -c 'kill -INT \$\$; exit 2'"
+check_exit 2 -S '--ignore "INT"' -S "" -S '--add TERM --block' sh -c 'kill -INT $$; kill -TERM $$; exit 2'
+check_exit 125 -S '--ignore "INT' true
+check_exit 125 -S '--ignore INT\' true
+cat >shebang <<EOF
+#!${NOSIG} -S --ignore INT --ignore TERM -- sh
+kill -INT \$\$
+kill -TERM \$\$
+exit 2
+EOF
+chmod a+rx shebang
+check_exit 2 ./shebang
+
+: "### Check fd closing"
+check_exit 0 sh -c 'echo >&5' 5>/dev/null
+check_exit 2 --close-fds sh -c 'echo >&5 || exit 2' 5>/dev/null
+check_exit 0 --keep-fds 5 --close-fds sh -c 'echo >&5' 5>/dev/null
+check_exit 0 --keep-fds 4-6 --close-fds sh -c 'echo >&5' 5>/dev/null
+check_exit 2 --keep-fds 4,6 --close-fds sh -c 'echo >&5 || exit 2' 5>/dev/null
+check_exit 2 --keep-fds 0-2 --close-fds sh -c 'echo >&5 || exit 2' 5>/dev/null
+check_exit 0 --keep-fds 3,0-1,9 --keep-fds 5 --close-fds sh -c 'echo >&5' 5>/dev/null
+check_exit 2 --close-fds --keep-fds 5 sh -c 'echo >&5 || exit 2' 5>/dev/null
+check_exit 0 --exec-fd 5 --close-fds foo -c true 5</bin/sh
+check_exit 125 --keep-fds 5-3 true
+check_exit 125 --keep-fds -1 true
+check_exit 125 --keep-fds foo true
+
+: "### Check listening sockets"
+out=$(nosig --listen tcp:127.0.0.1:0 --listen unix:listen.sock \
+	sh -c 'echo ${LISTEN_FDS} ${LISTEN_PID} $$')
+set -- ${out}
+[ "$1" = "2" ]
+[ "$2" = "$3" ]
+[ -S listen.sock ]
+# Stale sockets get replaced.
+check_exit 0 --listen unix:listen.sock --close-fds sh -c ': <&3'
+# Fds the user explicitly set up can't be replaced.
+check_exit 125 --fd 3=/dev/null --listen unix:listen.sock true
+check_exit 125 --listen unix:listen.sock --fd 3=/dev/null true
+check_exit 0 --fd 5=/dev/null --listen unix:listen.sock sh -c ': <&3 <&5'
+# The program to exec gets moved out of the way.
+[ "$(nosig --exec-fd 3 --listen unix:listen.sock foo -c 'echo ${LISTEN_FDS}' 3</bin/sh)" = "1" ]
+check_exit 125 --listen tcp:127.0.0.1 true
+check_exit 125 --listen foo:bar true
+check_exit 125 --listen unix:/does/not/exist true
+if type -P python3 >/dev/null; then
+	# Connections are queued up before the program accepts them.
+	out=$(nosig --listen unix:listen.sock python3 -c '
+import os, socket
+c = socket.socket(socket.AF_UNIX)
+c.connect("listen.sock")
+s = socket.socket(fileno=3)
+a, _ = s.accept()
+c.send(b"ok")
+print(a.recv(2).decode(), s.type == socket.SOCK_STREAM)
+')
+	[ "${out}" = "ok True" ]
+	# Sockets that are still in use are left alone.
+	out=$(python3 -c '
+import socket, subprocess, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind("live.sock")
+s.listen()
+print(subprocess.call(sys.argv[1:]))
+' "${NOSIG}" --listen unix:live.sock true)
+	[ "${out}" = "125" ]
+	[ -S live.sock ]
+fi
+
+: "### Check resource limits"
+[ "$(nosig --rlimit nofile=100 sh -c 'ulimit -n')" = "100" ]
+[ "$(nosig --rlimit RLIMIT_CORE=0:0 sh -c 'ulimit -c')" = "0" ]
+[ "$(nosig --rlimit Core=0 --rlimit core=:0 sh -c 'ulimit -H -c')" = "0" ]
+[ "$(nosig --rlimit core=0:0 sh -c 'ulimit -c 1 2>/dev/null || echo no')" = "no" ]
+check_exit 125 --rlimit nofile true
+check_exit 125 --rlimit nofile=foo true
+check_exit 125 --rlimit foo=1 true
+check_exit 125 --rlimit core=1:0 true
+
+: "### Check scheduling settings"
+[ "$(nosig --nice 3 --nice 2 nice)" = "$(( $(nice) + 5 ))" ]
+check_exit 125 --nice foo true
+if nosig --help | grep -q -e --sched; then
+	if type -P chrt >/dev/null; then
+		nosig --sched batch chrt -p 0 | grep -q SCHED_BATCH
+		nosig --sched idle chrt -p 0 | grep -q SCHED_IDLE
+	fi
+	check_exit 125 --sched foo true
+	check_exit 125 --sched fifo true
+	check_exit 125 --sched batch:1 true
+	check_exit 125 --sched fifo:1000 true
+fi
+if nosig --help | grep -q -e --cpus; then
+	nosig --cpus 0 grep Cpus_allowed_list /proc/self/status | grep -q -x $'Cpus_allowed_list:\t0'
+	check_exit 125 --cpus 1-0 true
+	check_exit 125 --cpus 1000000 true
+
+	# Fake a system with 2 nodes/packages/L3s with 2 cores of 2 threads each.
+	sysfs="${PWD}/sysfs"
+	mkdir -p "${sysfs}"/devices/system/{cpu,node/node{0,1}}
+	echo 0-7 >"${sysfs}"/devices/system/cpu/online
+	echo 0-3 >"${sysfs}"/devices/system/node/node0/cpulist
+	echo 4-7 >"${sysfs}"/devices/system/node/node1/cpulist
+	for cpu in {0..7}; do
+		d="${sysfs}/devices/system/cpu/cpu${cpu}"
+		mkdir -p "${d}"/topology "${d}"/cache/index{0,1,2}
+		pkg=$(( cpu / 4 * 4 ))
+		core=$(( cpu / 2 * 2 ))
+		echo "${pkg}-$(( pkg + 3 ))" >"${d}"/topology/core_siblings_list
+		echo "${core}-$(( core + 1 ))" >"${d}"/topology/thread_siblings_list
+		printf '1\nData\n1\nInstruction\n3\nUnified\n' | {
+			for i in 0 1 2; do
+				read -r level
+				read -r type
+				echo "${level}" >"${d}"/cache/index${i}/level
+				echo "${type}" >"${d}"/cache/index${i}/type
+			done
+		}
+		echo "${core}-$(( core + 1 ))" >"${d}"/cache/index0/shared_cpu_list
+		echo "${core}-$(( core + 1 ))" >"${d}"/cache/index1/shared_cpu_list
+		echo "${pkg}-$(( pkg + 3 ))" >"${d}"/cache/index2/shared_cpu_list
+	done
+	check_cpus() {
+		local exp="$1"
+		shift
+		local out
+		# The CPUs don't exist, so don't worry about actually using them.
+		out=$(NOSIG_SYSFS_ROOT="${sysfs}" "${NOSIG}" -v --cpus "$@" true 2>&1 || :)
+		[[ ${out} == *"using cpus: ${exp}"* ]]
+	}
+	check_cpus 4-7 node:1
+	check_cpus 4-7 llc:1
+	check_cpus 0-3,6 llc:0,6
+	check_cpus 4-7 core-siblings-of:5
+	check_cpus 4-5 thread-siblings-of:5
+	check_cpus 0,4 spread:2
+	check_cpus 0,2,4 spread:3
+	check_cpus 0-2,4,6 spread:5
+	check_cpus 0-7 spread:8
+	NOSIG_SYSFS_ROOT="${sysfs}" check_exit 125 --cpus node:2 true
+	NOSIG_SYSFS_ROOT="${sysfs}" check_exit 125 --cpus llc:2 true
+	NOSIG_SYSFS_ROOT="${sysfs}" check_exit 125 --cpus spread:9 true
+	NOSIG_SYSFS_ROOT="${sysfs}" check_exit 125 --cpus thread-siblings-of:8 true
+	NOSIG_SYSFS_ROOT="${sysfs}" check_exit 125 --cpus foo:1 true
+fi
+
+: "### Check NUMA memory policies"
+if nosig --help | grep -q -e --membind && [ -e /proc/self/numa_maps ]; then
+	nosig --membind 0 cat /proc/self/numa_maps | grep -q ' bind:0 '
+	nosig --interleave all cat /proc/self/numa_maps | grep -q ' interleave:'
+	nosig --preferred 0 cat /proc/self/numa_maps | grep -q ' prefer:0 '
+	check_exit 125 --membind 1000 true
+	check_exit 125 --membind 1-0 true
+	check_exit 125 --preferred all --preferred 0-1 true
+	check_exit 125 --interleave foo true
+fi
+
+: "### Check process attributes"
+if nosig --help | grep -q -e --oom-score-adj; then
+	[ "$(nosig --oom-score-adj 500 cat /proc/self/oom_score_adj)" = "500" ]
+	check_exit 125 --oom-score-adj 1001 true
+	if nosig --help | grep -q -e --disable-thp; then
+		nosig --disable-thp grep -q -x $'THP_enabled:\t0' /proc/self/status
+	fi
+	if [ -e /proc/self/timerslack_ns ]; then
+		[ "$(nosig --timer-slack 123456 cat /proc/self/timerslack_ns)" = "123456" ]
+	fi
+	check_exit 125 --timer-slack -1 true
+	if type -P ionice >/dev/null; then
+		[ "$(nosig --ioprio idle ionice)" = "idle" ]
+		[ "$(nosig --ioprio be:7 ionice)" = "best-effort: prio 7" ]
+	fi
+	check_exit 125 --ioprio foo true
+	check_exit 125 --ioprio be:8 true
+	check_exit 125 --ioprio idle:1 true
+fi
+
+: "### Check cgroups"
+# Fake a cgroup with a plain directory & file.
+mkdir cgroup
+: >cgroup/cgroup.procs
+out=$(nosig --cgroup cgroup sh -c 'echo $$')
+[ "$(cat cgroup/cgroup.procs)" = "${out}" ]
+# The supervisor stays where it is while the child moves.
+out=$(nosig --cgroup cgroup --close-fds --capture-on-failure capture.log \
+	sh -c 'echo $$ $PPID; exit 1' || :)
+set -- $(cat capture.log)
+[ "$(cat cgroup/cgroup.procs)" = "$1" ]
+[ "$1" != "$2" ]
+check_exit 125 --cgroup does-not-exist true
+mkdir not-a-cgroup
+check_exit 125 --cgroup not-a-cgroup true
+
+: "### Check program warming"
+if nosig --help | grep -q -e --warm; then
+	out=$("${NOSIG}" -v --warm true 2>&1)
+	[[ ${out} == *"warming /"*"/true"* ]]
+	if type -P ldd >/dev/null && ldd "$(type -P true)" | grep -q libc.so; then
+		[[ ${out} == *"warming /"*"/libc.so"* ]]
+	fi
+	# Non-ELF programs are fine too.
+	printf '#!/bin/sh\nexit 3\n' >warm.sh
+	chmod a+rx warm.sh
+	check_exit 3 --warm ./warm.sh
+	check_exit 127 --warm ./does-not-exist
+fi
+
+: "### Check generic fd setup"
+nosig --fd 1=fd-file:creat,wronly echo hi
+[ "$(cat fd-file)" = "hi" ]
+nosig --fd 1=fd-file:append echo there
+[ "$(cat fd-file)" = "hi
+there" ]
+nosig --fd 1=fd-file:wronly,trunc echo bye
+[ "$(cat fd-file)" = "bye" ]
+out=$(nosig --fd 5=fd-file sh -c 'cat <&5')
+[ "${out}" = "bye" ]
+out=$(nosig --fd 5=fd-file:rdonly --fd 0=fd:5 cat)
+[ "${out}" = "bye" ]
+out=$(nosig --fd 5=fd-file:rdonly,cloexec sh -c 'cat <&5 || echo closed' 2>/dev/null)
+[ "${out}" = "closed" ]
+check_exit 125 --fd 1=fd-file:excl,creat true
+check_exit 125 --fd 5=does-not-exist true
+check_exit 125 --fd 5=fd-file:bogus true
+check_exit 125 --fd 5 true
+check_exit 125 --fd =fd-file true
+check_exit 125 --fd 5=fd:99 true
+cp fd-file fd:1
+out=$(nosig --fd 5=./fd:1 sh -c 'cat <&5')
+[ "${out}" = "bye" ]
+
+if nosig --help | grep -q -e --pipe-size; then
+	nosig --pipe-size 8k true
+	check_exit 125 --pipe-size 1q true
+	check_exit 125 --pipe-size -1 true
+	if type -P python3 >/dev/null; then
+		out=$(nosig --pipe-size 128k python3 -c 'import fcntl; print(fcntl.fcntl(1, 1032))' | cat)
+		[ "${out}" = "131072" ]
+	fi
+fi
+
+: "### Check log sinks"
+# The sink keeps the original stderr open, so piping it waits for the sink.
+nosig --log-to logs sh -c 'echo hi out; echo hi err >&2' 2>&1 | cat
+[ "$(cat logs/log)" = "hi out
+hi err" ]
+nosig --log-to logs echo more 2>&1 | cat
+[ "$(cat logs/log)" = "hi out
+hi err
+more" ]
+rm -rf logs
+
+nosig --log-size 10 --log-keep 2 --log-to logs \
+	sh -c 'for i in 1 2 3 4 5 6; do echo line-$i-xxx; sleep 0.1; done' 2>&1 | cat
+[ ! -e logs/log.3 ]
+[ -s logs/log.2 -a -s logs/log.1 ]
+out=$(cat logs/log.2 logs/log.1 logs/log)
+[[ ${out} == *"line-6-xxx" && ${out} != *"line-1-xxx"* ]]
+rm -rf logs
+
+nosig --log-size 1 --log-keep 0 --log-to logs echo foo 2>&1 | cat
+[ "$(ls logs)" = "log" ]
+[ ! -s logs/log ]
+rm -rf logs
+
+nosig --log-age 1 --log-to logs sh -c 'echo a; sleep 2; echo b' 2>&1 | cat
+[ "$(cat logs/log.1)" = "a" ]
+[ "$(cat logs/log)" = "b" ]
+rm -rf logs
+
+check_exit 3 --log-to logs sh -c 'exit 3'
+check_exit 125 --log-to stdin-file/foo true
+check_exit 125 --log-size 1x --log-to logs true
+check_exit 125 --log-age -1 --log-to logs true
+check_exit 125 --log-keep -1 --log-to logs true
+# Settings after the last --log-to would be silently ignored.
+check_exit 125 --log-size 1 true
+check_exit 125 --log-to logs --log-keep 1 true
+nosig --log-to logs --log-age 1 --log-to logs true 2>&1 | cat
+rm -rf logs
+
+# An ignored SIGCHLD must not break starting the sink, and still reach the program.
+nosig --ignore CHLD --log-to logs sh -c 'echo chld' 2>&1 | cat
+[ "$(cat logs/log)" = "chld" ]
+nosig --ignore CHLD --log-to logs --show-status 2>&1 | cat
+tr ' ' '\n' <logs/log | grep -qx i17
+rm -rf logs
+
+: "### Check tee"
+# The sink holds the original stdout, so this waits for it.
+out=$(nosig --tee tee-1 --tee tee-2 --tee fd:5 sh -c 'echo hi out; echo hi err >&2' 2>/dev/null 5>tee-3)
+[ "${out}" = "hi out" ]
+[ "$(cat tee-1)" = "hi out" ]
+[ "$(cat tee-2)" = "hi out" ]
+[ "$(cat tee-3)" = "hi out" ]
+out=$(nosig --tee tee-1:append sh -c 'echo more')
+[ "$(cat tee-1)" = "hi out
+more" ]
+seq 1 100000 >tee-in
+# The sink outlives nosig, so read through a pipe to wait for it to finish.
+nosig --tee tee-1 cat tee-in | cat >tee-out
+cmp tee-in tee-1
+cmp tee-in tee-out
+# The tee outputs aren't inherited by the program, so --close-fds has to keep them.
+out=$(nosig --tee tee-1 --close-fds echo hi)
+[ "${out}" = "hi" ]
+[ "$(cat tee-1)" = "hi" ]
+check_exit 3 --tee tee-1 sh -c 'exit 3'
+check_exit 125 --tee stdin-file/foo true
+check_exit 125 --tee fd:99 true
+check_exit 125 --tee unix:does-not-exist true
+if type -P python3 >/dev/null; then
+	python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.bind("sock")
+s.listen(1)
+print("ready", flush=True)
+c, _ = s.accept()
+with open("sock-out", "wb") as f:
+    while True:
+        data = c.recv(65536)
+        if not data:
+            break
+        f.write(data)
+' | (read ready; nosig --tee unix:sock echo via socket >/dev/null)
+	[ "$(cat sock-out)" = "via socket" ]
+fi
+rm -f tee-* sock sock-out
+
+: "### Check timestamps"
+out=$(nosig --timestamp realtime sh -c 'echo hi out; echo hi err >&2; printf "a\nb\n\n"; printf "no newline"' 2>ts-err)
+[[ ${out} =~ ^[0-9]{4}-[0-9]{2}-[0-9]{2}\ [0-9:]{8}\.[0-9]{6}\ out:\ hi\ out$'\n'.*' out: a'$'\n'.*' out: b'$'\n'.*' out: '$'\n'.*' out: no newline'$ ]]
+# NB: The shell trace output goes to stderr too.
+grep -E '^[0-9-]+ [0-9:.]+ err: hi err$' ts-err
+out=$(nosig --timestamp monotonic echo hi)
+[[ ${out} =~ ^[0-9]+\.[0-9]{6}\ out:\ hi$ ]]
+# Make sure lots of output (more than a single read/writev) works.
+seq 1 100000 >ts-in
+nosig --timestamp monotonic cat ts-in | sed 's:.* out\: ::' >ts-out
+cmp ts-in ts-out
+check_exit 3 --timestamp monotonic sh -c 'exit 3'
+check_exit 125 --timestamp bogus true
+rm -f ts-*
+
+: "### Check capture on failure"
+out=$(nosig --capture-on-failure capture sh -c 'echo hi out; echo hi err >&2')
+[ -z "${out}" ]
+[ ! -e capture ]
+
+out=$(nosig --capture-on-failure capture sh -c 'echo hi out; echo hi err >&2; exit 3') || ret=$?
+[ ${ret} -eq 3 ]
+[ -z "${out}" ]
+[ "$(cat capture)" = "hi out
+hi err" ]
+rm capture
+
+check_exit ${sigret} --capture-on-failure capture sh -c 'echo dead; kill -INT $$'
+[ "$(cat capture)" = "dead" ]
+rm capture
+
+check_exit 1 --capture-size 10 --capture-on-failure capture sh -c 'printf 0123456789abcdefghijklm; exit 1'
+[ "$(cat capture)" = "defghijklm" ]
+rm capture
+
+# Signals sent to nosig are forwarded to the program.
+# NB: Background jobs start with SIGINT ignored, so use SIGTERM.
+"${NOSIG}" --capture-on-failure capture sleep 10 &
+pid=$!
+sleep 0.5
+kill -TERM ${pid}
+ret=0
+wait ${pid} || ret=$?
+[ ${ret} -eq $(( 128 + 15 )) ]
+rm capture
+
+# Don't wait for background programs holding the output open.
+check_exit 1 --capture-on-failure capture sh -c '(sleep 10 >/dev/null 2>&1 </dev/null &); echo bg; (sleep 10 &); exit 1'
+[ "$(cat capture)" = "bg" ]
+rm capture
+
+check_exit 125 --capture-size 0 --capture-on-failure capture true
+check_exit 125 --capture-size foo --capture-on-failure capture true
+# The size is only used by the next --capture-on-failure.
+check_exit 125 --capture-on-failure capture --capture-size 5 true
+grep -q 'capture-size must come before' capture
+rm capture
+check_exit 125 --capture-size 5 true
+# An ignored SIGCHLD must not break supervising, and still reach the program.
+check_exit 3 --ignore CHLD --capture-on-failure capture sh -c 'exit 3'
+nosig --ignore CHLD --capture-on-failure capture --stdout status --show-status
+tr ' ' '\n' <status | grep -qx i17
+rm status
+
+: "### Check redirection doesn't leak fds"
+if [ -d /proc/self/fd ]; then
+	echo foo >stdin-file
+	[ "$(nosig ls /proc/self/fd)" = "$(nosig --stdin stdin-file --stdout /dev/stdout ls /proc/self/fd)" ]
+fi
+
+: "### Check environment handling"
+out=$(FOO=foo nosig sh -c 'echo ${FOO}')
+[ "${out}" = "foo" ]
+out=$(FOO=foo nosig FOO=bar sh -c 'echo ${FOO}')
+[ "${out}" = "bar" ]
+out=$(FOO=foo nosig --unset FOO sh -c 'echo ${FOO-unset}')
+[ "${out}" = "unset" ]
+out=$(FOO=foo nosig --clear-env BAR=bar BAR=baz /usr/bin/env)
+[ "${out}" = "BAR=baz" ]
+out=$(nosig A=1 "${NOSIG}" B=2 sh -c 'echo ${A}${B}')
+[ "${out}" = "12" ]
+check_exit 127 --clear-env PATH=/does/not/exist true
+check_exit 125 --unset FOO=bar true
+printf 'echo "$@"\n' >noshebang
+chmod a+rx noshebang
+out=$(nosig --clear-env ./noshebang a b)
+[ "${out}" = "a b" ]
+
+: "### Check session & process groups"
+# The pgrp & session fields from /proc/<pid>/stat.
+if [ -e /proc/self/stat ]; then
+	get_ids='echo $$ $(cut -d" " -f5,6 /proc/$$/stat)'
+	out=$(nosig --setsid sh -c "${get_ids}")
+	[ "${out}" = "$(echo ${out%% *} ${out%% *} ${out%% *})" ]
+	out=$(nosig --setpgid sh -c "${get_ids}")
+	read pid pgrp sid <<<"${out}"
+	[ ${pid} -eq ${pgrp} -a ${pid} -ne ${sid} ]
+	# Group leaders have to fork first.
+	out=$(nosig --setpgid "${NOSIG}" --setsid sh -c "${get_ids}")
+	[ "${out}" = "$(echo ${out%% *} ${out%% *} ${out%% *})" ]
+fi
+check_exit 3 --setpgid "${NOSIG}" --setsid sh -c 'exit 3'
+check_exit ${sigret} --setpgid "${NOSIG}" --setsid sh -c 'kill -INT $$; exit 2'
+# An ignored SIGCHLD must not break waiting, but should still reach the program.
+check_exit 3 --setpgid "${NOSIG}" --ignore CHLD --setsid sh -c 'exit 3'
+get_status --setpgid "${NOSIG}" --ignore CHLD --setsid
+grep -qx i17 <<<"${out}"
+# No controlling terminal after starting a new session.
+check_exit 125 --setsid --foreground true
+
+: "### Check program execution options"
+out=$(nosig --exec-path /bin/sh foo -c 'echo $0')
+[ "${out}" = "foo" ]
+out=$(nosig --exec-fd 3 foo -c 'echo $0' 3</bin/sh)
+[ "${out}" = "foo" ]
+check_exit 127 --exec-path ./does-not-exist true
+check_exit 126 --exec-path ./noexec true
+check_exit 125 --exec-fd 99 true
+check_exit 125 --exec-fd foo true
+out=$(nosig -v --exec-path "${NOSIG}" foo --exec-path /bin/sh bar -c 'echo $0' 2>&1)
+[[ ${out} == *"folding nested invocation: foo"*bar ]]
+# The fd of the outer --exec-fd isn't leaked into the program.
+check_exit 0 --exec-fd 5 foo --exec-path /bin/sh bar \
+	-c 'cat <&5 >/dev/null 2>&1 && exit 1; exit 0' 5<"${NOSIG}"
+
 : "### Check I/O redirection"
 echo foo >stdin-file
 out=$(nosig --stdin stdin-file cat)
@@ -369,8 +862,97 @@ out=$(nosig --output output-file sh -c 'echo hi out; echo hi err >&2')
 [ "$(cat output-file)" = "hi out
 hi err" ]
 
+# Existing files are truncated like shell redirects rather than written over.
+echo "a long line of text" >stdout-file
+nosig --stdout stdout-file echo hi
+[ "$(cat stdout-file)" = "hi" ]
+echo "a long line of text" >stderr-file
+nosig --stderr stderr-file sh -c 'echo hi >&2'
+[ "$(cat stderr-file)" = "hi" ]
+echo "a long line of text" >output-file
+nosig --output output-file echo hi
+[ "$(cat output-file)" = "hi" ]
+
 out=$(nosig --null-io sh -c 'echo hi out; echo hi err >&2; cat')
 [ -z "${out}" ]
 
+: "### Check signal tracing"
+if nosig --help | grep -q -e --trace-signals; then
+	nosig --trace-signals trace.log sh -c 'trap : USR1; kill -USR1 $$; exit 0'
+	grep -q "^[0-9]*\.[0-9]* tid=[0-9]* sig=SIGUSR1 code=0 pid=[0-9]* uid=$(id -u)$" trace.log
+	check_exit 3 --trace-signals trace.log sh -c 'exit 3'
+	check_exit ${sigret} --trace-signals trace.log sh -c 'kill -INT $$'
+	grep -q "sig=SIGINT" trace.log
+	# Stop signals leave the program stopped until it's continued.
+	"${NOSIG}" --trace-signals trace.log sh -c 'kill -STOP $$; exit 4' &
+	pid=$!
+	while ! grep -q "sig=SIGSTOP" trace.log 2>/dev/null; do sleep 0.1; done
+	pkill -CONT -P ${pid}
+	ret=0
+	wait ${pid} || ret=$?
+	[ ${ret} -eq 4 ]
+	# Binary records are a fixed size.
+	nosig --trace-format binary --trace-signals trace.bin \
+		sh -c 'trap : USR1 USR2; kill -USR1 $$; kill -USR2 $$'
+	[ $(wc -c <trace.bin) -eq 64 ]
+	check_exit 125 --trace-format foo true
+	# The format is only used by the next --trace-signals.
+	check_exit 125 --trace-signals trace.log --trace-format binary true
+	check_exit 125 --trace-format binary true
+	# Faults don't have a sender (the siginfo holds the address instead).
+	if type -P python3 >/dev/null; then
+		nosig --trace-signals trace.log python3 -c 'import ctypes; ctypes.string_at(0x1234)' || :
+		grep -q "sig=SIGSEGV code=1 pid=- uid=-$" trace.log
+	fi
+fi
+
+: "### Check the tiny build"
+NOSIG_TINY="${NOSIG}-tiny"
+if [ -x "${NOSIG_TINY}" ]; then
+	# It should set up the exact same state as the full build.
+	for opts in "-I INT" "--ignore-all" "--ignore-all-rt -D RTMIN+3" \
+	            "--block-all-std" "-f -d INT -b" "-e -aSIGRTMAX-2 --add=USR1 -s" \
+	            "--fill --block --reset" "--ignore-all --default-all-std"; do
+		[ "$("${NOSIG_TINY}" ${opts} "${NOSIG}" --show-status)" = \
+		  "$(nosig ${opts} --show-status)" ]
+	done
+	tiny_exit() {
+		local ret=0
+		"${NOSIG_TINY}" "${@:2}" || ret=$?
+		[ ${ret} -eq $1 ]
+	}
+	tiny_exit 0 true
+	tiny_exit 3 -- sh -c 'exit 3'
+	tiny_exit 125
+	tiny_exit 125 --help true
+	tiny_exit 125 -I FOO true
+	tiny_exit 126 ./stdout-file
+	tiny_exit 127 ./does-not-exist
+	# Other exec failures (e.g. ELOOP) are errors like the full nosig.
+	ln -sf tiny-loop tiny-loop
+	tiny_exit 125 ./tiny-loop
+	check_exit 125 ./tiny-loop
+	printf 'exit 4\n' >tiny.sh
+	chmod a+rx tiny.sh
+	[ "$(PATH="${PWD}" "${NOSIG_TINY}" tiny.sh; echo $?)" = "4" ]
+	# Nothing from the C library (e.g. malloc) may be linked in.
+	if type -P nm >/dev/null; then
+		[ -z "$(nm "${NOSIG_TINY}" | grep -E -w 'U|malloc|calloc|realloc|free|brk|sbrk')" ]
+	fi
+fi
+
+: "### Check the signal benchmark"
+SIGBENCH="${TESTDIR}/sigbench"
+if [ -x "${SIGBENCH}" ]; then
+	# Only check the shape of the report as the timing & counts depend on the
+	# system.  Skip pidfd as older kernels don't have it.
+	out=$("${SIGBENCH}" -N "${NOSIG}" -n 10 -s USR1 -s RTMIN -S kill -S sigqueue)
+	echo "${out}" | awk 'NR > 1 && $1 ~ /^SIG/ && $2 != "" { ++rows } END { exit rows != 24 }'
+	out=$("${SIGBENCH}" -N "${NOSIG}" -n 10 -s USR1 -S kill -w handler -- --block-all)
+	[[ ${out} == *"signal not delivered"* ]]
+	# The -T stress modes depend on load & the per-user SigQ, so they're only
+	# run by `make bench`.
+fi
+
 : "### All passed!"
 set +x
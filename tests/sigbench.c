@@ -0,0 +1,703 @@
+/*
+ * Benchmark the latency of signal delivery to a program set up by nosig.
+ *
+ * We fork a target program (this one, run via nosig) and time how long it takes
+ * from just before a signal is sent until the target wakes up from it, across
+ * different ways of sending (kill/sigqueue/pidfd_send_signal) and of waiting
+ * (a handler/sigwaitinfo/signalfd).  For targets where nosig ignores or blocks
+ * the signal, nothing wakes up, so we time the send itself instead.
+ *
+ * The target writes a CLOCK_MONOTONIC timestamp to a pipe once woken up, so the
+ * latency is one-way and doesn't include the reply.  For stable numbers, pin the
+ * two sides to CPUs, e.g.:
+ *	nosig --cpus 2 ./tests/sigbench -- --cpus 3
+ *
+ * With -T, it instead floods the target from multiple threads for a while, and
+ * counts how many signals woke it up vs were coalesced (standard signals can
+ * only be pending once), are still queued (realtime signals, per SigQ), or were
+ * rejected (realtime signals fail with EAGAIN once the RLIMIT_SIGPENDING queue
+ * is full).  This shows whether e.g. --block-all keeps a program safe under
+ * load, and how big the queue needs to be.
+ *
+ * Only Linux is supported.
+ *
+ * Written by Mike Frysinger <vapier@gmail.com>
+ * Released into the public domain.
+ */
+
+/* Enable OS extensions (e.g. Linux syscalls). */
+#define _GNU_SOURCE
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "../signames.h"
+
+#ifndef __linux__
+# error "sigbench only supports Linux"
+#endif
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#define streq(s1, s2) (strcmp(s1, s2) == 0)
+
+/* How long to wait for the target before deciding the signal was lost. */
+#define TIMEOUT_MS 1000
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Parse a signal with the same syntax as nosig (the "SIG" is optional). */
+static int get_signal_num(const char *name)
+{
+	const char *s = strncasecmp(name, "SIG", 3) ? name : &name[3];
+	size_t i;
+	char *end;
+	long sig;
+
+	for (i = 0; i < signals_cnt; ++i)
+		if (strcasecmp(&signals[i].name[3], s) == 0)
+			return signals[i].value;
+
+	if (strncasecmp(s, "RTMIN", 5) == 0) {
+		sig = SIGRTMIN + (s[5] ? strtol(&s[5], &end, 10) : 0);
+		if (s[5] && (s[5] != '+' || *end))
+			sig = 0;
+	} else if (strncasecmp(s, "RTMAX", 5) == 0) {
+		sig = SIGRTMAX + (s[5] ? strtol(&s[5], &end, 10) : 0);
+		if (s[5] && (s[5] != '-' || *end))
+			sig = 0;
+	} else {
+		sig = strtol(name, &end, 10);
+		if (*end)
+			sig = 0;
+	}
+	if (sig < 1 || sig > SIGRTMAX || (sig > 31 && sig < SIGRTMIN))
+		errx(EXIT_FAILURE, "unknown signal: %s", name);
+	return sig;
+}
+
+/*
+ * The target side.  It waits for |sig| in the requested way, and writes the
+ * time it woke up to |report_fd|.  A 0 is written first to say it's ready.
+ */
+enum wakeup {
+	WAKE_HANDLER,
+	WAKE_SIGWAITINFO,
+	WAKE_SIGNALFD,
+	/* These leave the signal state as nosig set it, and never wake up. */
+	WAKE_IGNORED,
+	WAKE_BLOCKED,
+	WAKE_NONE,
+};
+static const char * const wakeups[] = {
+	[WAKE_HANDLER] = "handler",
+	[WAKE_SIGWAITINFO] = "sigwaitinfo",
+	[WAKE_SIGNALFD] = "signalfd",
+	[WAKE_IGNORED] = "ignored",
+	[WAKE_BLOCKED] = "blocked",
+	[WAKE_NONE] = "none",
+};
+
+static int report_fd;
+
+static void report(uint64_t ns)
+{
+	if (write(report_fd, &ns, sizeof(ns)) != sizeof(ns))
+		_exit(EXIT_FAILURE);
+}
+
+static void handler(int sig)
+{
+	(void)sig;
+	report(now_ns());
+}
+
+static int target(enum wakeup wakeup, int sig)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+
+	switch (wakeup) {
+	case WAKE_HANDLER: {
+		struct sigaction sa = { .sa_handler = handler, .sa_flags = SA_RESTART, };
+		if (sigaction(sig, &sa, NULL))
+			err(EXIT_FAILURE, "sigaction() failed");
+		report(0);
+		while (true)
+			pause();
+	}
+
+	case WAKE_SIGWAITINFO:
+		sigprocmask(SIG_BLOCK, &set, NULL);
+		report(0);
+		while (true) {
+			siginfo_t si;
+			if (sigwaitinfo(&set, &si) == sig)
+				report(now_ns());
+		}
+
+	case WAKE_SIGNALFD: {
+		sigprocmask(SIG_BLOCK, &set, NULL);
+		int fd = signalfd(-1, &set, 0);
+		if (fd < 0)
+			err(EXIT_FAILURE, "signalfd() failed");
+		report(0);
+		while (true) {
+			struct signalfd_siginfo ssi;
+			if (read(fd, &ssi, sizeof(ssi)) == sizeof(ssi))
+				report(now_ns());
+		}
+	}
+
+	case WAKE_IGNORED:
+	case WAKE_BLOCKED:
+	case WAKE_NONE:
+		report(0);
+		while (true)
+			pause();
+	}
+
+	return EXIT_FAILURE;
+}
+
+/*
+ * The sender side.
+ */
+enum sender {
+	SEND_KILL,
+	SEND_SIGQUEUE,
+	SEND_PIDFD,
+};
+static const char * const senders[] = {
+	[SEND_KILL] = "kill",
+	[SEND_SIGQUEUE] = "sigqueue",
+	[SEND_PIDFD] = "pidfd",
+};
+
+static const char *nosig = "./nosig";
+static char self[PATH_MAX];
+static char **nosig_args;
+static size_t iterations = 10000;
+static size_t threads = 0;
+static double rate = 0, duration = 1;
+
+struct target {
+	pid_t pid;
+	int pidfd;
+	int report_fd;
+};
+
+/* Wait up to |timeout| ms for the next timestamp from the target. */
+static bool read_report(const struct target *t, int timeout, uint64_t *ns)
+{
+	struct pollfd pfd = { .fd = t->report_fd, .events = POLLIN, };
+	if (poll(&pfd, 1, timeout) != 1)
+		return false;
+	return read(t->report_fd, ns, sizeof(*ns)) == sizeof(*ns);
+}
+
+/* Run the target via nosig with the settings for |wakeup| & the user's options. */
+static void start_target(struct target *t, enum wakeup wakeup, int sig)
+{
+	char sigstr[12], wakestr[12], fdstr[12];
+	int fds[2];
+
+	if (pipe(fds))
+		err(EXIT_FAILURE, "pipe() failed");
+	snprintf(sigstr, sizeof(sigstr), "%i", sig);
+	snprintf(wakestr, sizeof(wakestr), "%i", wakeup);
+	snprintf(fdstr, sizeof(fdstr), "%i", fds[1]);
+
+	t->pid = fork();
+	if (t->pid < 0)
+		err(EXIT_FAILURE, "fork() failed");
+	if (t->pid == 0) {
+		size_t nargs = 0, i;
+		for (i = 0; nosig_args[i]; ++i)
+			continue;
+		char *argv[i + 20];
+
+		close(fds[0]);
+		argv[nargs++] = (char *)nosig;
+		if (wakeup == WAKE_IGNORED) {
+			argv[nargs++] = (char *)"--ignore";
+			argv[nargs++] = sigstr;
+		} else if (wakeup == WAKE_BLOCKED) {
+			argv[nargs++] = (char *)"--add";
+			argv[nargs++] = sigstr;
+			argv[nargs++] = (char *)"--block";
+		}
+		for (i = 0; nosig_args[i]; ++i)
+			argv[nargs++] = nosig_args[i];
+		argv[nargs++] = (char *)"--";
+		argv[nargs++] = self;
+		argv[nargs++] = (char *)"--target";
+		argv[nargs++] = wakestr;
+		argv[nargs++] = sigstr;
+		argv[nargs++] = fdstr;
+		argv[nargs] = NULL;
+		execv(nosig, argv);
+		err(127, "could not run %s", nosig);
+	}
+	close(fds[1]);
+
+	t->report_fd = fds[0];
+#ifdef SYS_pidfd_open
+	t->pidfd = syscall(SYS_pidfd_open, t->pid, 0);
+#else
+	t->pidfd = -1;
+#endif
+	/* It can take a while for everything to load (e.g. --warm). */
+	uint64_t ns;
+	if (!read_report(t, TIMEOUT_MS * 10, &ns))
+		errx(EXIT_FAILURE, "target did not start");
+}
+
+/* Kill the target & describe what happened to it. */
+static const char *stop_target(struct target *t)
+{
+	static char buf[40];
+	int status;
+
+	if (waitpid(t->pid, &status, WNOHANG) == 0) {
+		kill(t->pid, SIGKILL);
+		waitpid(t->pid, &status, 0);
+		strcpy(buf, "");
+	} else if (WIFSIGNALED(status))
+		snprintf(buf, sizeof(buf), "target killed by %s",
+		         strsigname(WTERMSIG(status)));
+	else
+		snprintf(buf, sizeof(buf), "target exited %i", WEXITSTATUS(status));
+	close(t->report_fd);
+	if (t->pidfd >= 0)
+		close(t->pidfd);
+	return buf;
+}
+
+static int send_signal(const struct target *t, enum sender sender, int sig, size_t i)
+{
+	switch (sender) {
+	case SEND_KILL:
+		return kill(t->pid, sig);
+	case SEND_SIGQUEUE:
+		return sigqueue(t->pid, sig, (union sigval){ .sival_int = i, });
+	case SEND_PIDFD:
+#ifdef SYS_pidfd_send_signal
+		return syscall(SYS_pidfd_send_signal, t->pidfd, sig, NULL, 0);
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+	return -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void bench(int sig, enum sender sender, enum wakeup wakeup)
+{
+	uint64_t *lat = calloc(iterations, sizeof(*lat));
+	struct target t;
+	size_t i, n = 0, failed = 0;
+	const char *note = "";
+	bool woken = wakeup < WAKE_IGNORED;
+
+	if (lat == NULL)
+		err(EXIT_FAILURE, "calloc() failed");
+
+	start_target(&t, wakeup, sig);
+	if (sender == SEND_PIDFD && t.pidfd < 0) {
+		note = "pidfd not supported";
+		goto done;
+	}
+
+	/* Warm up the caches & scheduler before measuring anything. */
+	for (i = 0; i < iterations / 10 + 1; ++i) {
+		uint64_t ns;
+		if (send_signal(&t, sender, sig, i))
+			break;
+		if (woken && !read_report(&t, TIMEOUT_MS, &ns))
+			break;
+	}
+
+	for (i = 0; i < iterations; ++i) {
+		uint64_t start = now_ns(), end;
+		if (send_signal(&t, sender, sig, i)) {
+			/* RT signals fail w/EAGAIN once the pending queue is full. */
+			if (errno != EAGAIN) {
+				note = strerror(errno);
+				break;
+			}
+			++failed;
+			continue;
+		}
+		if (woken) {
+			if (!read_report(&t, TIMEOUT_MS, &end)) {
+				note = "signal not delivered";
+				break;
+			}
+		} else
+			end = now_ns();
+		lat[n++] = end - start;
+	}
+
+ done:
+	if (!*note)
+		note = stop_target(&t);
+	else
+		stop_target(&t);
+
+	printf("%-12s %-9s %-12s", strsigname(sig), senders[sender], wakeups[wakeup]);
+	if (n) {
+		qsort(lat, n, sizeof(*lat), cmp_u64);
+		printf(" %8zu %8zu %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64,
+		       n, failed, lat[0], lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+	} else
+		printf(" %8zu %8zu %8s %8s %8s %8s", n, failed, "-", "-", "-", "-");
+	if (*note)
+		printf("  %s", note);
+	printf("\n");
+	fflush(stdout);
+	free(lat);
+}
+
+/*
+ * The stress mode.  Every thread sends |sig| as fast as it can (or at its share
+ * of the requested rate) until the deadline.
+ */
+struct stress_thread {
+	pthread_t thread;
+	const struct target *t;
+	enum sender sender;
+	int sig;
+	uint64_t interval, deadline, end;
+	size_t sent, eagain;
+	int error;
+};
+
+static void *stress_sender(void *arg)
+{
+	struct stress_thread *st = arg;
+	uint64_t now, next = now_ns();
+
+	while ((now = now_ns()) < st->deadline) {
+		if (st->interval) {
+			if (next > now) {
+				struct timespec ts = {
+					.tv_sec = next / 1000000000,
+					.tv_nsec = next % 1000000000,
+				};
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			}
+			next += st->interval;
+		}
+
+		if (send_signal(st->t, st->sender, st->sig, st->sent) == 0)
+			++st->sent;
+		else if (errno == EAGAIN)
+			++st->eagain;
+		else {
+			st->error = errno;
+			break;
+		}
+	}
+	st->end = now_ns();
+
+	return NULL;
+}
+
+/* Count the target's wakeups until it goes quiet after |until| (or goes away). */
+static size_t drain_reports(const struct target *t, uint64_t until)
+{
+	uint64_t buf[512];
+	size_t count = 0;
+
+	while (true) {
+		struct pollfd pfd = { .fd = t->report_fd, .events = POLLIN, };
+		if (poll(&pfd, 1, 100) == 0) {
+			if (now_ns() >= until)
+				break;
+			continue;
+		}
+		ssize_t ret = read(t->report_fd, buf, sizeof(buf));
+		if (ret <= 0)
+			break;
+		count += ret / sizeof(*buf);
+	}
+
+	return count;
+}
+
+/* The signal state of the target from /proc/PID/status. */
+struct sig_state {
+	char sigq[32];		/* The SigQ field: queued signals/limit for the real uid */
+	long queued;		/* Just the queued part of SigQ */
+	bool pending;		/* Whether the signal is pending */
+	bool ignored;		/* Whether the signal is ignored */
+};
+
+static void read_sig_state(pid_t pid, int sig, struct sig_state *state)
+{
+	char path[40], line[256];
+	FILE *fp;
+
+	memset(state, 0, sizeof(*state));
+	strcpy(state->sigq, "-");
+	snprintf(path, sizeof(path), "/proc/%i/status", (int)pid);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "SigQ:", 5) == 0) {
+			snprintf(state->sigq, sizeof(state->sigq), "%.*s",
+			         (int)strcspn(&line[6], "\n"), &line[6]);
+			state->queued = strtol(&line[6], NULL, 10);
+		} else if (strncmp(line, "SigPnd:", 7) == 0 || strncmp(line, "ShdPnd:", 7) == 0)
+			state->pending |= (strtoull(&line[7], NULL, 16) >> (sig - 1)) & 1;
+		else if (strncmp(line, "SigIgn:", 7) == 0)
+			state->ignored = (strtoull(&line[7], NULL, 16) >> (sig - 1)) & 1;
+	}
+	fclose(fp);
+}
+
+static void stress(int sig, enum sender sender, enum wakeup wakeup)
+{
+	struct stress_thread st[threads];
+	struct target t;
+	size_t i, sent = 0, eagain = 0, delivered = 0;
+	const char *note = "";
+	struct sig_state before, after;
+	char coalesced[24] = "-", queued[24] = "-";
+	int error = 0;
+
+	start_target(&t, wakeup, sig);
+	read_sig_state(t.pid, sig, &before);
+	after = before;
+	uint64_t start = now_ns(), end = start, deadline = start + duration * 1000000000;
+	if (sender == SEND_PIDFD && t.pidfd < 0) {
+		note = "pidfd not supported";
+		goto done;
+	}
+
+	for (i = 0; i < threads; ++i) {
+		st[i] = (struct stress_thread){
+			.t = &t,
+			.sender = sender,
+			.sig = sig,
+			.interval = rate ? threads * 1000000000 / rate : 0,
+			.deadline = deadline,
+		};
+		errno = pthread_create(&st[i].thread, NULL, stress_sender, &st[i]);
+		if (errno)
+			err(EXIT_FAILURE, "pthread_create() failed");
+	}
+
+	/* Keep the pipe drained while the senders run so the target never stalls. */
+	delivered = drain_reports(&t, deadline);
+	for (i = 0; i < threads; ++i) {
+		pthread_join(st[i].thread, NULL);
+		sent += st[i].sent;
+		eagain += st[i].eagain;
+		if (st[i].end > end)
+			end = st[i].end;
+		if (st[i].error)
+			error = st[i].error;
+	}
+	delivered += drain_reports(&t, 0);
+	read_sig_state(t.pid, sig, &after);
+	if (error)
+		note = strerror(error);
+
+	/*
+	 * Realtime signals are queued, so count how many the target still has via
+	 * SigQ (it's per-user, so assume nothing else is queueing at the same time).
+	 * Standard signals can only be pending once, & the rest were coalesced.
+	 * Ignored signals are thrown away when they're sent, so are neither.
+	 */
+	if (sig >= SIGRTMIN) {
+		long cnt = after.queued - before.queued;
+		snprintf(queued, sizeof(queued), "%li", cnt > 0 ? cnt : 0);
+	} else {
+		size_t cnt = after.pending;
+		snprintf(queued, sizeof(queued), "%zu", cnt);
+		if (!after.ignored)
+			snprintf(coalesced, sizeof(coalesced), "%zu",
+			         sent > delivered + cnt ? sent - delivered - cnt : 0);
+	}
+
+ done:
+	if (!*note)
+		note = stop_target(&t);
+	else
+		stop_target(&t);
+
+	if (!*note && after.ignored)
+		note = "ignored by the target";
+
+	printf("%-12s %-9s %-12s %10.0f %10zu %10zu %10zu %10s %10s %12s %s",
+	       strsigname(sig), senders[sender], wakeups[wakeup],
+	       end > start ? sent / ((end - start) / 1e9) : 0, sent, eagain, delivered,
+	       coalesced, queued, after.sigq, after.pending ? "yes" : " no");
+	if (*note)
+		printf("  %s", note);
+	printf("\n");
+	fflush(stdout);
+}
+
+/* Look up |name| in |table| (which has |count| entries). */
+static int lookup(const char * const *table, size_t count, const char *name)
+{
+	size_t i;
+	for (i = 0; i < count; ++i)
+		if (streq(table[i], name))
+			return i;
+	errx(EXIT_FAILURE, "unknown mode: %s", name);
+}
+
+__attribute__((__noreturn__))
+static void usage(int status)
+{
+	fprintf(status ? stderr : stdout,
+		"Usage: sigbench [options] [-- <nosig options>]\n"
+		"\n"
+		"Measure the latency (in ns) of signals sent to a program run via nosig,\n"
+		"or with -T, how it copes with a flood of them.\n"
+		"The nosig options are applied to the target of every run.\n"
+		"\n"
+		"Options:\n"
+		"  -n <count>    Number of signals to send per run (default %zu)\n"
+		"  -N <path>     The nosig to use (default %s)\n"
+		"  -s <signal>   Signal to send (default USR1 & RTMIN)\n"
+		"  -S <sender>   kill, sigqueue, or pidfd (default all)\n"
+		"  -w <wakeup>   handler, sigwaitinfo, signalfd, ignored, blocked, or none\n"
+		"                (default all)\n"
+		"\n"
+		"Stress options:\n"
+		"  -T <threads>  Flood the target from this many sender threads\n"
+		"  -r <rate>     Total signals per second to send (default unlimited)\n"
+		"  -t <seconds>  How long to send for (default %g)\n"
+		"\n"
+		"The -s/-S/-w options may be repeated; every combination is run.\n"
+		"The \"none\" wakeup leaves the signal state entirely up to nosig.\n",
+		iterations, nosig, duration);
+	exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+	int sigs[_NSIG], nsigs = 0;
+	bool use_sender[ARRAY_SIZE(senders)] = { false };
+	bool use_wakeup[ARRAY_SIZE(wakeups)] = { false };
+	bool any_sender = false, any_wakeup = false;
+	size_t s, w;
+	int i, c;
+
+	if (!signames_init())
+		err(EXIT_FAILURE, "signames_init() failed");
+
+	if (argc == 5 && streq(argv[1], "--target")) {
+		report_fd = atoi(argv[4]);
+		return target(atoi(argv[2]), atoi(argv[3]));
+	}
+
+	while ((c = getopt(argc, argv, "n:N:s:S:w:T:r:t:h")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			if (iterations == 0)
+				errx(EXIT_FAILURE, "invalid count: %s", optarg);
+			break;
+		case 'N':
+			nosig = optarg;
+			break;
+		case 's':
+			if (nsigs < _NSIG)
+				sigs[nsigs++] = get_signal_num(optarg);
+			break;
+		case 'S':
+			use_sender[lookup(senders, ARRAY_SIZE(senders), optarg)] = true;
+			any_sender = true;
+			break;
+		case 'w':
+			use_wakeup[lookup(wakeups, ARRAY_SIZE(wakeups), optarg)] = true;
+			any_wakeup = true;
+			break;
+		case 'T':
+			threads = strtoul(optarg, NULL, 10);
+			if (threads == 0 || threads > 1024)
+				errx(EXIT_FAILURE, "invalid thread count: %s", optarg);
+			break;
+		case 'r':
+			rate = strtod(optarg, NULL);
+			if (rate < 0)
+				errx(EXIT_FAILURE, "invalid rate: %s", optarg);
+			break;
+		case 't':
+			duration = strtod(optarg, NULL);
+			if (duration <= 0)
+				errx(EXIT_FAILURE, "invalid duration: %s", optarg);
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+	nosig_args = &argv[optind];
+
+	/* The target is run via nosig, so resolve ourselves while we still can. */
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (len < 0)
+		err(EXIT_FAILURE, "readlink(/proc/self/exe) failed");
+	self[len] = '\0';
+
+	if (nsigs == 0) {
+		sigs[nsigs++] = SIGUSR1;
+		sigs[nsigs++] = SIGRTMIN;
+	}
+	for (s = 0; s < ARRAY_SIZE(senders); ++s)
+		use_sender[s] |= !any_sender;
+	for (w = 0; w < ARRAY_SIZE(wakeups); ++w)
+		use_wakeup[w] |= !any_wakeup;
+
+	if (threads)
+		printf("%-12s %-9s %-12s %10s %10s %10s %10s %10s %10s %12s %s\n",
+		       "signal", "sender", "wakeup", "sent/s", "sent", "eagain",
+		       "delivered", "coalesced", "queued", "sigq", "pending");
+	else
+		printf("%-12s %-9s %-12s %8s %8s %8s %8s %8s %8s\n",
+		       "signal", "sender", "wakeup", "count", "eagain", "min", "p50", "p99", "max");
+	fflush(stdout);
+	for (i = 0; i < nsigs; ++i)
+		for (w = 0; w < ARRAY_SIZE(wakeups); ++w)
+			for (s = 0; s < ARRAY_SIZE(senders); ++s)
+				if (use_wakeup[w] && use_sender[s])
+					(threads ? stress : bench)(sigs[i], s, w);
+
+	return EXIT_SUCCESS;
+}